@@ -21,9 +21,10 @@
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
  * Pentium versions of start_counter() and get_counter()
+ * (rdtsc works the same way on x86-64)
  *******************************************************/
 
 
@@ -71,6 +72,15 @@ double get_counter()
 }
 /* $end x86cyclecounter */
 
+/* Return the raw value of the cycle counter */
+unsigned long long read_counter()
+{
+    unsigned hi, lo;
+
+    access_counter(&hi, &lo);
+    return ((unsigned long long) hi << 32) | lo;
+}
+
 #elif defined(__alpha)
 
 /****************************************************
@@ -133,6 +143,12 @@ double get_counter()
     return result;
 }
 
+/* Only the lower 32 bits count cycles of the process */
+unsigned long long read_counter()
+{
+    return counter();
+}
+
 #else
 
 /****************************************************************
@@ -158,6 +174,13 @@ double get_counter()
     printf("Please choose another timing package in config.h.\n");
     exit(1);
 }
+
+unsigned long long read_counter()
+{
+    printf("ERROR: You are trying to use a read_counter routine in clock.c\n");
+    printf("that has not been implemented yet on this platform.\n");
+    exit(1);
+}
 #endif
 
 
@@ -6,6 +6,9 @@ void start_counter();
 /* Get # cycles since counter started */
 double get_counter();
 
+/* Get the raw counter value, cheap enough to time single calls */
+unsigned long long read_counter();
+
 /* Measure overhead for counter */
 double ovhd();
 
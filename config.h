@@ -30,7 +30,9 @@
   "random-bal.rep",\
   "random2-bal.rep",\
   "binary-bal.rep",\
-  "binary2-bal.rep"
+  "binary2-bal.rep",\
+  "realloc-bal.rep",\
+  "realloc2-bal.rep"
 
 /*
  * This constant gives the estimated performance of the libc malloc
@@ -43,6 +45,15 @@
  */
 #define AVG_LIBC_THRUPUT      9000E3  /* 9000 Kops/sec */
 
+/*
+ * With CALIBRATE_THRUPUT set, mdriver measures the throughput of libc
+ * malloc on the same traces and machine before every run and caps the
+ * throughput at that instead, so the index doesn't depend on how fast
+ * the reference system was. AVG_LIBC_THRUPUT remains the cap if the
+ * measurement fails.
+ */
+#define CALIBRATE_THRUPUT 1
+
  /*
   * This constant determines the contributions of space utilization
   * (UTIL_WEIGHT) and throughput (1 - UTIL_WEIGHT) to the performance
@@ -51,14 +62,18 @@
 #define UTIL_WEIGHT .60
 
 /*
- * Alignment requirement in bytes (either 4 or 8)
+ * Alignment requirement in bytes (8, or 16 in the 64-bit build)
  */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
 
 /*
  * Maximum heap size in bytes
  */
+#ifndef MAX_HEAP
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#endif
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
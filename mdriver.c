@@ -14,12 +14,27 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <math.h>
 #include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <dlfcn.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "fcyc.h"
+#include "perfctr.h"
+#include "clock.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -29,28 +44,59 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define MAX(x, y)  ((x) > (y) ? (x) : (y))
+#define MIN(x, y)  ((x) < (y) ? (x) : (y))
+#define MT_RUNS        3 /* timed runs of a multithreaded replay, best one counts */
+#define TIME_SAMPLES   5 /* timed runs of each trace with -o or -C (unless -s) */
+#define MAX_REFS       8 /* reference allocators that mm can be compared with */
+
+/* 
+ * A trace is slower than its baseline when its mean time grew by more 
+ * than COMPARE_MIN and by more than COMPARE_SIGMAS standard deviations 
+ * of the noise of both measurements. Its utilization is deterministic, 
+ * so any drop beyond COMPARE_UTIL counts as well.
+ */
+#define COMPARE_MIN    0.10
+#define COMPARE_SIGMAS 3.0
+#define COMPARE_UTIL   0.001
+
+/* Number of heap size samples taken over the course of a trace */
+#define HEAP_SAMPLES  10
+
+/* Free block sizes are counted below 64 bytes, 256, 1K... up to 64K and above */
+#define FRAG_BUCKETS   7
+
+/* Latency histograms have 4 buckets for each power of two cycles */
+#define HIST_BUCKETS 256
+
+/* 
+ * Under cache pressure (-X) the buffer is thrashed after every 
+ * PRESSURE_EVERY requests unless the option says otherwise, one write
+ * per CACHE_LINE bytes. The cold start is the first COLD_START_OPS.
+ */
+#define PRESSURE_EVERY  16
+#define CACHE_LINE      64
+#define COLD_START_OPS 100
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The records form an AVL 
+ * tree ordered by address, payloads never overlap so lo and hi agree.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* payloads below lo */
+    struct range_t *right; /* payloads above hi */
+    int height;            /* height of the subtree rooted here */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
@@ -60,8 +106,26 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapping of a binary trace that ops points into... */
+    size_t map_size;     /* ... and its size, or NULL and 0 for text traces */
 } trace_t;
 
+/* 
+ * An allocator that the mm package is compared with: libc malloc, or 
+ * one that a shared library such as jemalloc or a libmm.so built from 
+ * another mm.c provides
+ */
+typedef struct {
+    char *name;          /* for the tables, e.g. jemalloc */
+    char *path;          /* the library to dlopen, NULL for libc */
+    int shown;           /* asked for with -l or -R, not only run to calibrate */
+    void *(*malloc_fn)(size_t);
+    void (*free_fn)(void *);
+    void *(*realloc_fn)(void *, size_t);
+    void *(*calloc_fn)(size_t, size_t);
+    int (*memalign_fn)(void **, size_t, size_t);
+} ref_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -70,27 +134,196 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    ref_t *ref;      /* the allocator of eval_ref_speed */
 } speed_t;
 
-/* Summarizes the important stats for some malloc function on some trace */
+/* The work that a child process does for eval_ref and eval_mm_rss */
+typedef struct {
+    speed_t *params;     /* the trace and the allocator */
+    int tracenum;        /* for error messages */
+    struct stats *stats; /* the results, which go back to the parent */
+} child_t;
+
+/* The free blocks of the mm heaps at one point of a trace */
+typedef struct {
+    double op;           /* requests done when it was taken */
+    double live;         /* payload bytes allocated at that point */
+    double blocks;       /* number of blocks in the heaps */
+    double free_blocks;  /* number of free blocks... */
+    double free_bytes;   /* ... the bytes in them ... */
+    double largest;      /* ... and the largest one */
+    double hist[FRAG_BUCKETS]; /* free blocks by size, see frag_bucket */
+} frag_t;
+
+/* A binary heap snapshot (-D) is a snaphdr_t and count snapblk_t */
+#define SNAP_MAGIC "mmsnap1"
+typedef struct {
+    char magic[8];       /* SNAP_MAGIC */
+    int32_t trace;       /* number of the trace... */
+    int32_t op;          /* ... and its requests done */
+    uint64_t live;       /* payload bytes allocated */
+    uint64_t count;      /* number of blocks that follow */
+} snaphdr_t;
+
+typedef struct {
+    uint64_t addr;       /* payload address */
+    uint32_t size;       /* size of the whole block */
+    uint16_t arena;      /* arena whose heap it is in */
+    uint16_t state;      /* an mm_block_t */
+} snapblk_t;
+
+/* Log-bucketed histogram of the cycles that single requests took */
+typedef struct {
+    double n;                           /* number of requests */
+    unsigned long long max;             /* slowest request */
+    unsigned long long counts[HIST_BUCKETS];
+} hist_t;
+
+/* A replay of some trace with the caches thrashed between requests (-X) */
 typedef struct {
+    int valid;           /* was the trace replayed under pressure? */
+    double start;        /* cycles of mm_init and the first COLD_START_OPS requests */
+    double cycles;       /* cycles of all requests, the thrashing not counted */
+    hist_t hist;         /* latencies of single requests */
+} cold_t;
+
+/* Summarizes the important stats for some malloc function on some trace */
+typedef struct stats {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    int samples;     /* number of times the trace was timed... */
+    double secs_mean;  /* ... the mean of these times ... */
+    double secs_sd;    /* ... and their standard deviation, secs is the least */
+    cold_t cold;       /* replay under cache pressure with -X */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double rss_peak;   /* growth of the resident set while replaying it once */
+    double heap_peak;  /* largest heap size in bytes while running the trace */
+    double heap_end;   /* heap size after the last request */
+    double heap_samples[HEAP_SAMPLES]; /* heap size after each tenth of it */
+    mm_stats_t mm;     /* counters of the mm package after the trace */
+    frag_t frag;       /* free blocks at the tenth of the trace with most live bytes */
+    double perf[PERFCTR_NUM]; /* events of a replay with -P, -1 if not counted */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* One thread's share of a trace in the multithreaded replay */
+typedef struct {
+    trace_t *trace;      /* the trace being replayed */
+    int num_ops;         /* number of requests made by this thread */
+    int *ops;            /* indices of these requests in trace->ops */
+    int *seqs;           /* for each of them, number of earlier requests on its id */
+    int *done;           /* per id, number of its requests completed so far */
+    char **blocks;       /* ptrs to the blocks, shared unless each thread has a copy */
+    pthread_barrier_t *start; /* lets all threads start at the same time */
+    double begin;        /* wall clock time when the thread started... */
+    double end;          /* ... and when it was done */
+} replay_t;
+
+/* Summarizes a multithreaded replay of some trace */
+typedef struct {
+    int valid;           /* was the trace replayed? */
+    double ops;          /* number of requests made by all threads together */
+    double secs;         /* wall clock time of the fastest run */
+    double min_lat;      /* average secs per request of the fastest thread... */
+    double avg_lat;      /* ... of all threads ... */
+    double max_lat;      /* ... and of the slowest thread */
+} mt_stats_t;
+
+/* Latencies of the mm package on some trace, one histogram per request type */
+typedef struct {
+    int valid;           /* was the trace timed? */
+    hist_t hists[5];     /* indexed by the request type */
+} lat_stats_t;
+
+/* The requests of a trace grouped into runs for the batch replay */
+typedef struct {
+    trace_t *trace;      /* the trace being replayed */
+    int *runs;           /* runs[i] is the length of the run starting at request i */
+    void **ptrs;         /* the blocks of the run being replayed */
+    range_t **ranges;    /* if not NULL, check the blocks against this range tree */
+    int tracenum;        /* for error messages */
+} batch_t;
+
+/* Summarizes the batch replay of some trace */
+typedef struct {
+    int valid;           /* was the trace replayed correctly? */
+    double ops;          /* number of requests in the trace */
+    double runs;         /* number of calls of the mm package */
+    double secs;         /* number of secs needed to replay the trace */
+} batch_stats_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
+static int num_threads = 0; /* threads of the multithreaded replay (0 = none) */
+static int copy_trace = 0;  /* each thread replays all of the trace (-c) */
+static int time_ops = 0;    /* time every request of the mm package (-L) */
+static int batch_ops = 0;   /* also replay the traces with batch requests (-b) */
+static int num_samples = 0; /* timed runs of each trace (-s, 0 = default) */
+static int count_events = 0; /* count the hardware events of a replay (-P) */
+static ref_t refs[MAX_REFS];  /* the reference allocators (-l, -R) */
+static int num_refs = 0;
+static mem_backend_t backend = MEM_BACKEND_MALLOC; /* heap storage (-m) */
+static FILE *snap_fp = NULL; /* write heap snapshots here (-D) ... */
+static int snap_json = 0;    /* ... as JSON rather than binary */
+static int snaps = 0;        /* snapshots written so far */
+static int num_jobs = 1;     /* worker processes that check the traces (-j) */
+static size_t pressure_bytes = 0; /* thrash this much memory (-X) ... */
+static int pressure_every = PRESSURE_EVERY; /* ... after so many requests */
+
+/* Names of the request types in the latency tables and the results files */
+static char *op_names[] = {"malloc", "free", "realloc", "memalign", "calloc"};
+
+/* The counters of mm_stats_t by the names they have in the results files */
+static struct {
+    char *name;
+    size_t offset;
+} mm_fields[] = {
+    {"heap_grows", offsetof(mm_stats_t, heap_grows)},
+    {"heap_grow_bytes", offsetof(mm_stats_t, heap_grow_bytes)},
+    {"heap_trims", offsetof(mm_stats_t, heap_trims)},
+    {"heap_trim_bytes", offsetof(mm_stats_t, heap_trim_bytes)},
+    {"mallocs", offsetof(mm_stats_t, mallocs)},
+    {"malloc_bytes", offsetof(mm_stats_t, malloc_bytes)},
+    {"block_bytes", offsetof(mm_stats_t, block_bytes)},
+    {"free_blocks", offsetof(mm_stats_t, free_blocks)},
+    {"free_bytes", offsetof(mm_stats_t, free_bytes)},
+    {"fit_searches", offsetof(mm_stats_t, fit_searches)},
+    {"fit_steps", offsetof(mm_stats_t, fit_steps)},
+    {"fit_misses", offsetof(mm_stats_t, fit_misses)},
+    {"splits", offsetof(mm_stats_t, splits)},
+    {"coalesce_none", offsetof(mm_stats_t, coalesces[0])},
+    {"coalesce_next", offsetof(mm_stats_t, coalesces[1])},
+    {"coalesce_prev", offsetof(mm_stats_t, coalesces[2])},
+    {"coalesce_both", offsetof(mm_stats_t, coalesces[3])},
+    {"slabs", offsetof(mm_stats_t, slabs)},
+    {"consolidations", offsetof(mm_stats_t, consolidations)},
+    {"grow_step", offsetof(mm_stats_t, grow_step)},
+};
+#define NUM_MM_FIELDS ((int)(sizeof(mm_fields) / sizeof(mm_fields[0])))
+#define MM_FIELD(m, f) (*(size_t *)((char *)(m) + mm_fields[f].offset))
+
+/* The free block sizes of frag_t in the results files */
+static char *frag_names[FRAG_BUCKETS] = {
+    "lt64", "lt256", "lt1k", "lt4k", "lt16k", "lt64k", "ge64k"
+};
+
+/* The latency percentiles in the results files */
+static struct {
+    char *name;
+    double p;
+} lat_fields[] = {
+    {"p50", 0.50}, {"p90", 0.90}, {"p99", 0.99}, {"p999", 0.999},
+};
+#define NUM_LAT_FIELDS ((int)(sizeof(lat_fields) / sizeof(lat_fields[0])))
 
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
@@ -105,51 +338,144 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *insert_range(range_t *root, range_t *p);
+static range_t *delete_range(range_t *root, char *lo);
+static range_t *detach_min_range(range_t *root, range_t **min);
+static range_t *balance_range(range_t *p);
+static range_t *rotate_range(range_t *p, int left);
+static int range_height(range_t *p);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void map_trace(trace_t *trace, int fd, char *path);
 static void free_trace(trace_t *trace);
 
-/* Routines for evaluating the correctness and speed of libc malloc */
-static int eval_libc_valid(trace_t *trace, int tracenum);
-static void eval_libc_speed(void *ptr);
+/* Routines for evaluating the correctness, speed and memory use of libc
+   malloc and the other reference allocators */
+static ref_t *add_ref(char *path);
+static void load_ref(ref_t *ref);
+static void eval_ref(ref_t *ref, trace_t *trace, int tracenum, stats_t *stats);
+static void ref_child(child_t *child);
+static int eval_ref_valid(trace_t *trace, int tracenum, ref_t *ref);
+static void eval_ref_speed(void *ptr);
+static double calibrate_thruput(int n, stats_t **ref_stats);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void snapshot(int tracenum, int op, int live, stats_t *stats);
+static void frag_block(void *arg, int arena, void *bp, size_t size, 
+		       mm_block_t state);
+static void dump_block(void *arg, int arena, void *bp, size_t size,
+		       mm_block_t state);
+static int frag_bucket(size_t size);
+static void time_trace(fsecs_test_funct f, void *argp, stats_t *stats);
+static void eval_mm_rss(speed_t *params, stats_t *stats);
+static void mm_rss_child(child_t *child);
+
+/* Routines for measuring in a child process */
+static int run_child(void (*f)(child_t *), child_t *child);
+static double reset_rss(void);
+static double vm_status(char *field);
+
+/* Check the traces in parallel worker processes */
+static void eval_mm_parallel(char **tracefiles, int n, stats_t *stats);
+static void reap_worker(pid_t *pids, int *fds, int n, stats_t *stats);
+
+/* Routines for replaying a trace with several threads at once */
+static void eval_mm_threads(trace_t *trace, mt_stats_t *stats);
+static void *replay_thread(void *ptr);
+static double wall_secs(void);
+
+/* Routines for timing every single request */
+static void eval_mm_latency(trace_t *trace, lat_stats_t *stats);
+static void hist_add(hist_t *hist, unsigned long long cycles);
+static void hist_merge(hist_t *to, hist_t *from);
+static unsigned long long hist_percentile(hist_t *hist, double p);
+static unsigned long long counter_overhead(void);
+
+/* Routines for replaying a trace under cache pressure */
+static void eval_cold(ref_t *ref, trace_t *trace, stats_t *stats);
+static void cold_child(child_t *child);
+static void cold_request(ref_t *ref, trace_t *trace, traceop_t *op);
+static void thrash(volatile char *buf);
+
+/* Replay the mm package with batches of requests */
+static void eval_mm_batch(trace_t *trace, int tracenum, range_t **ranges,
+			  batch_stats_t *stats);
+static void eval_mm_batch_speed(void *ptr);
+static int replay_batch(batch_t *batch);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printresults_mt(int n, mt_stats_t *stats);
+static void printresults_heap(int n, stats_t *stats);
+static void printresults_mm(int n, stats_t *stats);
+static void printresults_frag(int n, stats_t *stats);
+static void printresults_lat(int n, lat_stats_t *stats);
+static void printresults_batch(int n, batch_stats_t *stats, stats_t *mm_stats);
+static void printresults_perf(int n, stats_t *stats);
+static void printresults_refs(int n, stats_t *mm_stats, stats_t **ref_stats);
+static void printresults_cold(int n, stats_t *mm_stats, stats_t **ref_stats);
+
+/* Routines for writing the results to a file and comparing them to a baseline */
+static void write_results(char *path, char **tracefiles, int n, stats_t *stats,
+			  lat_stats_t *lat_stats, double perfindex);
+static void write_results_json(FILE *fp, char **tracefiles, int n, 
+			       stats_t *stats, lat_stats_t *lat_stats, 
+			       double perfindex);
+static void write_results_csv(FILE *fp, char **tracefiles, int n, 
+			      stats_t *stats, lat_stats_t *lat_stats);
+static int compare_results(char *path, char **tracefiles, int n, 
+			   stats_t *stats);
+static void write_csv_field(FILE *fp, char *field);
+static int split_csv(char *line, char **fields, int max);
+static int find_field(char **fields, int n, char *name);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
 static void app_error(char *msg);
+static void parse_policy(char *arg);
+static void parse_trim(char *arg);
+static void parse_backend(char *arg);
+static void parse_pressure(char *arg);
+static size_t parse_size(char *arg);
 
 /**************
  * Main routine
  **************/
 int main(int argc, char **argv)
 {
-    int i;
+    int i, r;
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
-    stats_t *libc_stats = NULL;/* libc stats for each trace */
+    stats_t *ref_stats[MAX_REFS]; /* stats of each reference allocator */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    mt_stats_t *mt_stats = NULL; /* mm stats of the multithreaded replays */
+    lat_stats_t *lat_stats = NULL; /* latencies of the mm requests */
+    batch_stats_t *batch_stats = NULL; /* mm stats of the batch replays */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
-    int run_libc = 0;    /* If set, run libc malloc (set by -l) */
+    int shown_refs = 0;  /* reference allocators asked for by -l and -R */
+    double thruput_cap = AVG_LIBC_THRUPUT; /* no extra credit beyond this */
+    ref_t *ref;
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    size_t max_heap;     /* size of each heap (-H) */
+    char *results_file = NULL;  /* write the results to this file (-o) */
+    char *baseline_file = NULL; /* compare them to the results in this one (-C) */
+    int regressions = 0; /* traces that got slower than in the baseline */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +484,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:p:n:T:m:M:H:o:C:s:R:D:j:X:bcdhvVgalLP")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,11 +504,87 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'p': /* Placement policy of the mm package */
+            parse_policy(optarg);
+            break;
+        case 'T': /* When the mm package trims its heap */
+            parse_trim(optarg);
+            break;
+        case 'm': /* Where memlib gets the storage of the heaps */
+            parse_backend(optarg);
+            break;
+        case 'M': /* Smallest request that gets a mapping of its own */
+            mm_set_mmap_threshold(parse_size(optarg));
+            break;
+        case 'H': /* Largest size of each heap */
+            if ((max_heap = parse_size(optarg)) == 0) {
+		fprintf(stderr, "The heap size must be positive\n");
+		usage();
+		exit(1);
+	    }
+            mem_set_max_heap(max_heap);
+            break;
+        case 'd': /* Defer the coalescing of small freed blocks */
+            mm_set_deferred(1);
+            break;
+        case 'n': /* Also replay each trace with this many threads */
+            if ((num_threads = atoi(optarg)) < 1) {
+		fprintf(stderr, "The number of threads must be positive\n");
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'X': /* Replay the traces under cache pressure */
+            parse_pressure(optarg);
+            break;
+        case 'j': /* Check the traces in this many worker processes */
+            if ((num_jobs = atoi(optarg)) < 1) {
+		fprintf(stderr, "The number of workers must be positive\n");
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'c': /* Every thread replays a copy of the whole trace */
+            copy_trace = 1;
+            break;
+        case 'L': /* Time every request of the mm package */
+            time_ops = 1;
+            break;
+        case 'b': /* Also replay the traces with batch requests */
+            batch_ops = 1;
+            break;
+        case 'P': /* Count the hardware events of a replay of each trace */
+            count_events = 1;
+            break;
+        case 'D': /* Write snapshots of the heap to a file */
+            if ((snap_fp = fopen(optarg, "w")) == NULL) {
+		sprintf(msg, "Could not open %s", optarg);
+		unix_error(msg);
+	    }
+            snap_json = (strlen(optarg) >= 5 && 
+			 !strcmp(optarg + strlen(optarg) - 5, ".json"));
+            break;
+        case 'o': /* Write the results to a JSON or CSV file */
+            results_file = optarg;
+            break;
+        case 'C': /* Compare the results to a baseline CSV file */
+            baseline_file = optarg;
+            break;
+        case 's': /* Time each trace this many times */
+            if ((num_samples = atoi(optarg)) < 1) {
+		fprintf(stderr, "The number of samples must be positive\n");
+		usage();
+		exit(1);
+	    }
+            break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
-            run_libc = 1;
+            add_ref(NULL)->shown = 1;
+            break;
+        case 'R': /* Run the malloc of a shared library */
+            add_ref(optarg)->shown = 1;
             break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
@@ -235,43 +637,61 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* Results that go to a file or get compared need a measure of noise */
+    if (num_samples == 0)
+	num_samples = (results_file || baseline_file) ? TIME_SAMPLES : 1;
+
     /* Initialize the timing package */
     init_fsecs();
+    if (pressure_bytes > 0) {
+	set_fcyc_clear_cache(1);  /* only matters with USE_FCYC */
+	set_fcyc_cache_size(pressure_bytes);
+    }
+    if (count_events && perfctr_init() == 0)
+	printf("No hardware events can be counted on this machine.\n");
+
+    /* The throughput cap comes from libc malloc on this machine */
+    if (CALIBRATE_THRUPUT)
+	add_ref(NULL);
 
     /*
-     * Optionally run and evaluate the libc malloc package 
+     * Run and evaluate libc malloc and the other reference allocators,
+     * each trace in a child process of its own
      */
-    if (run_libc) {
-	if (verbose > 1)
-	    printf("\nTesting libc malloc\n");
+    for (r = 0; r < num_refs; r++) {
+	ref = &refs[r];
+	shown_refs += ref->shown;
+	if (verbose > 1 && ref->shown)
+	    printf("\nTesting %s malloc\n", ref->name);
 	
-	/* Allocate libc stats array, with one stats_t struct per tracefile */
-	libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-	if (libc_stats == NULL)
-	    unix_error("libc_stats calloc in main failed");
+	/* Allocate the stats array, with one stats_t struct per tracefile */
+	ref_stats[r] = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (ref_stats[r] == NULL)
+	    unix_error("ref_stats calloc in main failed");
 	
-	/* Evaluate the libc malloc package using the K-best scheme */
+	/* Evaluate the allocator using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
 	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
-	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
-		if (verbose > 1)
-		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-	    }
+	    ref_stats[r][i].ops = trace->num_ops;
+	    if (verbose > 1 && ref->shown)
+		printf("Checking %s malloc for correctness and performance.\n",
+		       ref->name);
+	    eval_ref(ref, trace, i, &ref_stats[r][i]);
+	    if (pressure_bytes > 0 && ref->shown && ref_stats[r][i].valid)
+		eval_cold(ref, trace, &ref_stats[r][i]);
 	    free_trace(trace);
 	}
 
-	/* Display the libc results in a compact table */
-	if (verbose) {
-	    printf("\nResults for libc malloc:\n");
-	    printresults(num_tracefiles, libc_stats);
+	/* Display the results in a compact table */
+	if (verbose && ref->shown) {
+	    printf("\nResults for %s malloc:\n", ref->name);
+	    printresults(num_tracefiles, ref_stats[r]);
 	}
     }
+    if (CALIBRATE_THRUPUT)
+	thruput_cap = calibrate_thruput(num_tracefiles, ref_stats);
+    if (verbose)
+	printf("Throughput cap = %.0f Kops/sec\n", thruput_cap/1e3);
 
     /*
      * Always run and evaluate the student's mm package
@@ -283,26 +703,88 @@ int main(int argc, char **argv)
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
+    if (num_threads > 0 &&
+	(mt_stats = (mt_stats_t *)calloc(num_tracefiles, 
+					 sizeof(mt_stats_t))) == NULL)
+	unix_error("mt_stats calloc in main failed");
+    if (time_ops &&
+	(lat_stats = (lat_stats_t *)calloc(num_tracefiles, 
+					   sizeof(lat_stats_t))) == NULL)
+	unix_error("lat_stats calloc in main failed");
+    if (batch_ops &&
+	(batch_stats = (batch_stats_t *)calloc(num_tracefiles, 
+					       sizeof(batch_stats_t))) == NULL)
+	unix_error("batch_stats calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
+    /* 
+     * The snapshots of the heap have to come in order, so -D checks the
+     * traces one by one. Otherwise workers can check correctness and 
+     * utilization of all traces at once before the timing starts.
+     */
+    if (num_jobs > 1 && snap_fp != NULL) {
+	printf("Checking the traces one by one for the heap snapshots.\n");
+	num_jobs = 1;
+    }
+    if (num_jobs > 1) {
+	if (verbose > 1)
+	    printf("Checking mm_malloc for correctness and efficiency "
+		   "with %d workers.\n", num_jobs);
+	eval_mm_parallel(tracefiles, num_tracefiles, mm_stats);
+    }
+
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
 	trace = read_trace(tracedir, tracefiles[i]);
 	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
+	if (num_jobs == 1) {
 	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+		printf("Checking mm_malloc for correctness, ");
+	    mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	    if (mm_stats[i].valid) {
+		if (verbose > 1)
+		    printf("efficiency, ");
+		mm_stats[i].util = eval_mm_util(trace, i, &ranges, 
+						&mm_stats[i]);
+	    }
+	}
+	if (mm_stats[i].valid) {
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+		printf(num_jobs == 1 ? "and performance.\n" : 
+		       "Timing mm_malloc on trace %d.\n", i);
+	    speed_params.ref = NULL;
+	    time_trace(eval_mm_speed, &speed_params, &mm_stats[i]);
+	    if (shown_refs > 0)
+		eval_mm_rss(&speed_params, &mm_stats[i]);
+	    if (pressure_bytes > 0) {
+		if (verbose > 1)
+		    printf("Replaying under cache pressure.\n");
+		eval_cold(NULL, trace, &mm_stats[i]);
+	    }
+	    if (count_events) {
+		if (verbose > 1)
+		    printf("Counting hardware events.\n");
+		perfctr_count(eval_mm_speed, &speed_params, mm_stats[i].perf);
+	    }
+	    if (num_threads > 0) {
+		if (verbose > 1)
+		    printf("Replaying with %d threads.\n", num_threads);
+		eval_mm_threads(trace, &mt_stats[i]);
+	    }
+	    if (time_ops) {
+		if (verbose > 1)
+		    printf("Timing every request.\n");
+		eval_mm_latency(trace, &lat_stats[i]);
+	    }
+	    if (batch_ops) {
+		if (verbose > 1)
+		    printf("Replaying with batch requests.\n");
+		eval_mm_batch(trace, i, &ranges, &batch_stats[i]);
+	    }
 	}
 	free_trace(trace);
     }
@@ -312,6 +794,67 @@ int main(int argc, char **argv)
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
+	printf("Heap sizes of mm malloc in KB:\n");
+	printresults_heap(num_tracefiles, mm_stats);
+	printf("\n");
+	printf("Internals of mm malloc:\n");
+	printresults_mm(num_tracefiles, mm_stats);
+	printf("\n");
+	printf("Free blocks of mm malloc when the most bytes were live:\n");
+	printresults_frag(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* The multithreaded results don't count towards the perf index */
+    if (num_threads > 0) {
+	if (copy_trace)
+	    printf("Results for mm malloc, %d threads replaying a copy each:\n",
+		   num_threads);
+	else
+	    printf("Results for mm malloc, trace split by id over %d threads:\n",
+		   num_threads);
+	printresults_mt(num_tracefiles, mt_stats);
+	printf("\n");
+    }
+
+    /* Neither do the latencies */
+    if (time_ops) {
+	printf("Latencies of mm malloc in cycles:\n");
+	printresults_lat(num_tracefiles, lat_stats);
+	printf("\n");
+    }
+
+    /* Nor does the comparison with the reference allocators */
+    if (shown_refs > 0) {
+	printf("Throughput (Kops) and peak resident set (KB) of mm malloc\n");
+	printf("and the reference allocators:\n");
+	printresults_refs(num_tracefiles, mm_stats, ref_stats);
+	printf("\n");
+    }
+
+    /* Nor does the replay under cache pressure */
+    if (pressure_bytes > 0) {
+	printf("Cycles per request of mm malloc");
+	if (shown_refs > 0)
+	    printf(" and the reference allocators");
+	printf(" with %luK thrashed\nafter every %d requests:\n", 
+	       (unsigned long)(pressure_bytes >> 10), pressure_every);
+	printresults_cold(num_tracefiles, mm_stats, ref_stats);
+	printf("\n");
+    }
+
+    /* Nor do the hardware events */
+    if (count_events) {
+	printf("Hardware events of mm malloc per request:\n");
+	printresults_perf(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Nor do the batch replays */
+    if (batch_ops) {
+	printf("Results for mm malloc with batch requests:\n");
+	printresults_batch(num_tracefiles, batch_stats, mm_stats);
+	printf("\n");
     }
 
     /* 
@@ -337,12 +880,12 @@ int main(int argc, char **argv)
 	avg_mm_throughput = ops/secs;
 
 	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
+	if (avg_mm_throughput > thruput_cap) {
 	    p2 = (double)(1.0 - UTIL_WEIGHT);
 	} 
 	else {
 	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
+		(avg_mm_throughput/thruput_cap);
 	}
 	
 	perfindex = (p1 + p2)*100.0;
@@ -362,21 +905,40 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
-    exit(0);
+    if (snap_fp != NULL) {
+	if (snap_json)
+	    fprintf(snap_fp, "%s]\n", snaps ? "\n" : "[");
+	if (fclose(snap_fp) != 0)
+	    unix_error("Could not write the heap snapshots");
+    }
+    if (results_file)
+	write_results(results_file, tracefiles, num_tracefiles, mm_stats,
+		      lat_stats, perfindex);
+    if (baseline_file) {
+	printf("\nComparison with %s:\n", baseline_file);
+	regressions = compare_results(baseline_file, tracefiles, 
+				      num_tracefiles, mm_stats);
+	if (regressions > 0)
+	    printf("%d traces got slower or less space efficient\n", 
+		   regressions);
+    }
+
+    exit(regressions > 0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. Adding and
+ * removing a range take O(log n) steps.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
@@ -395,19 +957,23 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or a mapping */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_is_mapped(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
+    /* 
+     * The payload must not overlap any other payloads. The payloads in
+     * the tree are disjoint, so an overlapping one lies on the path
+     * that a search for lo takes.
+     */
+    for (p = *ranges;  p != NULL;  p = (hi < p->lo) ? p->left : p->right) {
+        if (lo <= p->hi && hi >= p->lo) {
 	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
 		    lo, hi, p->lo, p->hi);
 	    malloc_error(tracenum, opnum, msg);
@@ -417,14 +983,15 @@ static int add_range(range_t **ranges, char *lo, int size,
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->left = p->right = NULL;
+    p->height = 1;
+    *ranges = insert_range(*ranges, p);
     return 1;
 }
 
@@ -433,19 +1000,7 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    *ranges = delete_range(*ranges, lo);
 }
 
 /*
@@ -453,16 +1008,129 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    free(p);
     *ranges = NULL;
 }
 
+/*
+ * insert_range - Add the range record p to the tree rooted at root
+ *     and return the new root
+ */
+static range_t *insert_range(range_t *root, range_t *p)
+{
+    if (root == NULL)
+	return p;
+    if (p->lo < root->lo)
+	root->left = insert_range(root->left, p);
+    else
+	root->right = insert_range(root->right, p);
+    return balance_range(root);
+}
+
+/*
+ * delete_range - Free the range record whose payload starts at lo in 
+ *     the tree rooted at root and return the new root
+ */
+static range_t *delete_range(range_t *root, char *lo)
+{
+    range_t *p, *right;
+
+    if (root == NULL)
+	return NULL;
+    if (lo < root->lo)
+	root->left = delete_range(root->left, lo);
+    else if (lo > root->lo)
+	root->right = delete_range(root->right, lo);
+    else {
+	p = root;
+	if (p->right == NULL)
+	    root = p->left;
+	else {
+	    /* The smallest record on the right takes the place of p */
+	    right = detach_min_range(p->right, &root);
+	    root->right = right;
+	    root->left = p->left;
+	}
+	free(p);
+	if (root == NULL)
+	    return NULL;
+    }
+    return balance_range(root);
+}
+
+/*
+ * detach_min_range - Unlink the smallest record of the tree rooted at
+ *     root, store it in *min and return the new root
+ */
+static range_t *detach_min_range(range_t *root, range_t **min)
+{
+    if (root->left == NULL) {
+	*min = root;
+	return root->right;
+    }
+    root->left = detach_min_range(root->left, min);
+    return balance_range(root);
+}
+
+/*
+ * balance_range - Restore the AVL property at p after a subtree of p 
+ *     grew or shrank by at most one level, and return the new root
+ */
+static range_t *balance_range(range_t *p)
+{
+    int diff = range_height(p->left) - range_height(p->right);
+
+    if (diff > 1) {
+	if (range_height(p->left->left) < range_height(p->left->right))
+	    p->left = rotate_range(p->left, 1);
+	return rotate_range(p, 0);
+    }
+    if (diff < -1) {
+	if (range_height(p->right->right) < range_height(p->right->left))
+	    p->right = rotate_range(p->right, 0);
+	return rotate_range(p, 1);
+    }
+    p->height = 1 + MAX(range_height(p->left), range_height(p->right));
+    return p;
+}
+
+/*
+ * rotate_range - Rotate the subtree at p to the left (or the right)
+ *     and return its new root
+ */
+static range_t *rotate_range(range_t *p, int left)
+{
+    range_t *q;
+
+    if (left) {
+	q = p->right;
+	p->right = q->left;
+	q->left = p;
+    }
+    else {
+	q = p->left;
+	p->left = q->right;
+	q->right = p;
+    }
+    p->height = 1 + MAX(range_height(p->left), range_height(p->right));
+    q->height = 1 + MAX(range_height(q->left), range_height(q->right));
+    return q;
+}
+
+/*
+ * range_height - Height of the subtree at p, 0 for an empty one
+ */
+static int range_height(range_t *p)
+{
+    return (p == NULL) ? 0 : p->height;
+}
+
 
 /**********************************************
  * The following routines manipulate tracefiles
@@ -477,9 +1145,10 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, align;
     unsigned max_index = 0;
     unsigned op_index;
+    char magic[TRACE_MAGIC_LEN];
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -495,15 +1164,25 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+
+    /* Binary traces are mapped as they are, text traces are parsed */
+    trace->map = NULL;
+    trace->map_size = 0;
+    if (fread(magic, 1, TRACE_MAGIC_LEN, tracefile) == TRACE_MAGIC_LEN &&
+	!memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN))
+	map_trace(trace, fileno(tracefile), path);
+    else {
+	rewind(tracefile);
+	fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+	fscanf(tracefile, "%d", &(trace->num_ids));     
+	fscanf(tracefile, "%d", &(trace->num_ops));     
+	fscanf(tracefile, "%d", &(trace->weight));        /* not used */
     
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
+	/* We'll store each request line in the trace in this array */
+	if ((trace->ops = 
+	     (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	    unix_error("malloc 2 failed in read_trace");
+    }
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks = 
@@ -515,6 +1194,11 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
     
+    if (trace->map != NULL) {
+	fclose(tracefile);
+	return trace;
+    }
+
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
@@ -527,6 +1211,21 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
+	case 'm':
+	    fscanf(tracefile, "%u %u %u", &index, &align, &size);
+	    trace->ops[op_index].type = MEMALIGN;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].align = align;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'c':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = CALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
 	case 'r':
 	    fscanf(tracefile, "%u %u", &index, &size);
 	    trace->ops[op_index].type = REALLOC;
@@ -554,13 +1253,72 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * map_trace - mmap the binary trace that fd refers to and point the
+ *     trace record at the header numbers and the requests in it
+ */
+static void map_trace(trace_t *trace, int fd, char *path)
+{
+    struct stat st;
+    tracehdr_t *hdr;
+    traceop_t *op;
+    int i;
+
+    if (fstat(fd, &st) < 0) {
+	sprintf(msg, "Could not stat %s in map_trace", path);
+	unix_error(msg);
+    }
+    trace->map_size = st.st_size;
+    if (trace->map_size < sizeof(tracehdr_t) ||
+	(trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, 
+			   fd, 0)) == MAP_FAILED) {
+	sprintf(msg, "Could not map %s in map_trace", path);
+	unix_error(msg);
+    }
+
+    hdr = (tracehdr_t *)trace->map;
+    if (hdr->op_size != sizeof(traceop_t)) {
+	printf("Binary tracefile %s has requests of %d bytes, not %d, "
+	       "convert its .rep file again\n", path, hdr->op_size, 
+	       (int)sizeof(traceop_t));
+	exit(1);
+    }
+    if (hdr->num_ops < 0 || hdr->num_ids < 0 ||
+	trace->map_size != sizeof(tracehdr_t) + 
+	(size_t)hdr->num_ops * sizeof(traceop_t)) {
+	printf("Corrupt binary tracefile %s\n", path);
+	exit(1);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = (traceop_t *)(hdr + 1);
+
+    /* The replays use the requests as they are, so check them once here */
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	if (op->index < 0 || op->index >= trace->num_ids || 
+	    (int)op->type < ALLOC || (int)op->type > CALLOC || op->size < 0 ||
+	    (op->type == MEMALIGN && 
+	     (op->align <= 0 || (op->align & (op->align - 1)) != 0))) {
+	    printf("Corrupt binary tracefile %s (request %d)\n", path, i);
+	    exit(1);
+	}
+    }
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated in read_trace(),
+ *              or unmap the requests of a binary trace.
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the three arrays... */
+	munmap(trace->map, trace->map_size);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -584,7 +1342,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -611,7 +1369,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
@@ -629,6 +1387,46 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    trace->block_sizes[index] = size;
 	    break;
 
+        case MEMALIGN: /* mm_memalign */
+
+	    /* Call the student's memalign, the block must have its alignment */
+	    if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_memalign failed.");
+		return 0;
+	    }
+	    if ((size_t)p % trace->ops[i].align != 0) {
+		malloc_error(tracenum, i, "mm_memalign returned a block that "
+			     "is not aligned as requested");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case CALLOC: /* mm_calloc */
+
+	    /* Call the student's calloc, every byte of the block must be 0 */
+	    if ((p = mm_calloc(1, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_calloc failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    for (j = 0; j < size; j++) {
+		if (p[j] != 0) {
+		    malloc_error(tracenum, i, "mm_calloc returned a block "
+				 "that is not cleared");
+		    return 0;
+		}
+	    }
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
         case REALLOC: /* mm_realloc */
 	    
 	    /* Call the student's realloc */
@@ -638,10 +1436,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range tree */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
@@ -653,7 +1451,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -689,15 +1487,17 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   largest size of the heap in bytes while running the student's malloc 
+ *   package on the trace. Since mem_trim() can decrement the brk pointer,
+ *   memlib keeps track of the high water mark of brk. The heap size is
+ *   also sampled over the course of the trace and recorded in stats,
+ *   and so are the free blocks (see snapshot).
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   stats_t *stats)
 {   
-    int i;
+    int i, sample = 0;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
@@ -709,15 +1509,24 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     mem_reset_brk();
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
+    stats->frag.live = -1;
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case MEMALIGN: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if (trace->ops[i].type == MEMALIGN)
+		p = mm_memalign(trace->ops[i].align, size);
+	    else if (trace->ops[i].type == CALLOC)
+		p = mm_calloc(1, size);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -772,9 +1581,119 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	/* Sample the heap size and take a snapshot after each tenth of the trace */
+	while (sample < HEAP_SAMPLES && 
+	       (double)(i + 1) * HEAP_SAMPLES >= (double)(sample + 1) * trace->num_ops) {
+	    stats->heap_samples[sample++] = mem_heapsize();
+	    snapshot(tracenum, i + 1, total_size, stats);
+	}
+    }
+
+    stats->heap_peak = mem_heappeak();
+    stats->heap_end = mem_heapsize();
+    stats->mm = mm_stats();
+    return ((double)max_total_size / (double)mem_heappeak());
+}
+
+/*
+ * snapshot - Walk the heaps after request op of the trace, when live
+ *    payload bytes were allocated. The free blocks of the walk with the
+ *    most live bytes go into stats, that is where fragmentation costs
+ *    the most utilization. With -D the blocks are written out as well.
+ */
+static void snapshot(int tracenum, int op, int live, stats_t *stats)
+{
+    frag_t frag;
+    snaphdr_t hdr;
+    int first = 1;
+
+    memset(&frag, 0, sizeof(frag));
+    frag.op = op;
+    frag.live = live;
+    mm_walk(frag_block, &frag);
+    if (frag.live > stats->frag.live)
+	stats->frag = frag;
+    if (snap_fp == NULL)
+	return;
+
+    if (snap_json) {
+	fprintf(snap_fp, "%s{\"trace\": %d, \"op\": %d, \"live\": %d, "
+		"\"blocks\": [", snaps ? ",\n" : "[\n", tracenum, op, live);
+	mm_walk(dump_block, &first);
+	fprintf(snap_fp, "]}");
+    }
+    else {
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+	hdr.trace = tracenum;
+	hdr.op = op;
+	hdr.live = live;
+	hdr.count = frag.blocks;
+	fwrite(&hdr, sizeof(hdr), 1, snap_fp);
+	mm_walk(dump_block, NULL);
+    }
+    snaps++;
+}
+
+/*
+ * frag_block - mm_walk callback that counts a block in a frag_t
+ */
+static void frag_block(void *arg, int arena, void *bp, size_t size, 
+		       mm_block_t state)
+{
+    frag_t *frag = (frag_t *)arg;
+
+    frag->blocks++;
+    if (state != MM_BLOCK_FREE)
+	return;
+    frag->free_blocks++;
+    frag->free_bytes += size;
+    if (size > frag->largest)
+	frag->largest = size;
+    frag->hist[frag_bucket(size)]++;
+}
+
+/*
+ * dump_block - mm_walk callback that writes a block to the snapshot
+ *    file, for JSON with arg pointing to a flag that is set until the
+ *    first block of the snapshot is written
+ */
+static void dump_block(void *arg, int arena, void *bp, size_t size,
+		       mm_block_t state)
+{
+    static char states[] = "fas"; /* the mm_block_t values */
+    int *first = (int *)arg;
+    snapblk_t blk;
+
+    if (snap_json) {
+	fprintf(snap_fp, "%s[%lu, %lu, %d, \"%c\"]", *first ? "" : ", ",
+		(unsigned long)(uintptr_t)bp, (unsigned long)size, arena, 
+		states[state]);
+	*first = 0;
+	return;
     }
+    blk.addr = (uintptr_t)bp;
+    blk.size = size;
+    blk.arena = arena;
+    blk.state = state;
+    fwrite(&blk, sizeof(blk), 1, snap_fp);
+}
+
+/*
+ * frag_bucket - Return the histogram bucket of a free block size: 0 for
+ *    below 64 bytes, each bucket after it up to 4 times as large
+ */
+static int frag_bucket(size_t size)
+{
+    int bucket = 0;
+    size_t limit = 64;
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    while (bucket < FRAG_BUCKETS - 1 && size >= limit) {
+	bucket++;
+	limit *= 4;
+    }
+    return bucket;
 }
 
 
@@ -805,8 +1724,24 @@ static void eval_mm_speed(void *ptr)
             trace->blocks[index] = p;
             break;
 
-	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
+        case MEMALIGN: /* mm_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case CALLOC: /* mm_calloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_calloc(1, size)) == NULL)
+		app_error("mm_calloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
             if ((newp = mm_realloc(oldp,newsize)) == NULL)
@@ -826,12 +1761,929 @@ static void eval_mm_speed(void *ptr)
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
+ * time_trace - Time f on the trace num_samples times. The least time 
+ *    goes into the performance index like a single one did, the mean 
+ *    and the standard deviation tell a comparison how noisy it is.
+ */
+static void time_trace(fsecs_test_funct f, void *argp, stats_t *stats)
+{
+    int i;
+    double secs, sum = 0, sumsq = 0, var;
+
+    stats->secs = DBL_MAX;
+    for (i = 0; i < num_samples; i++) {
+	secs = fsecs(f, argp);
+	stats->secs = (secs < stats->secs) ? secs : stats->secs;
+	sum += secs;
+	sumsq += secs * secs;
+    }
+    stats->samples = num_samples;
+    stats->secs_mean = sum / num_samples;
+    var = (num_samples > 1) ?
+	(sumsq - sum * sum / num_samples) / (num_samples - 1) : 0;
+    stats->secs_sd = (var > 0) ? sqrt(var) : 0;
+}
+
+/*
+ * eval_mm_rss - Measure how much the resident set grows while the mm 
+ *    package replays the trace once, in a child process like the 
+ *    reference allocators so that the numbers compare
+ */
+static void eval_mm_rss(speed_t *params, stats_t *stats)
+{
+    child_t child;
+
+    child.params = params;
+    child.tracenum = 0;
+    child.stats = stats;
+    if (run_child(mm_rss_child, &child) != 0)
+	stats->rss_peak = -1;
+}
+
+/*
+ * mm_rss_child - The part of eval_mm_rss in the child process. The heaps
+ *    get fresh storage first, the ones of the parent are resident already.
+ *    Storage from libc malloc would be pages that the parent touched too,
+ *    so the heaps get mappings instead.
+ */
+static void mm_rss_child(child_t *child)
+{
+    double rss;
+
+    mem_deinit();
+    if (backend == MEM_BACKEND_MALLOC)
+	mem_set_backend(MEM_BACKEND_MMAP);
+    mem_init();
+    rss = reset_rss();
+    eval_mm_speed(child->params);
+    child->stats->rss_peak = (rss < 0) ? -1 : vm_status("VmHWM:") - rss;
+}
+
+/*
+ * eval_mm_parallel - Check the correctness and the utilization of the 
+ *    mm package on every trace like the serial loop in main does, with
+ *    up to num_jobs worker processes at a time. Each worker handles one
+ *    trace on its own copy of the heap and sends its stats and errors
+ *    back through a pipe. All of them are done before main times the
+ *    first trace, so the timing doesn't compete with them.
+ */
+static void eval_mm_parallel(char **tracefiles, int n, stats_t *stats)
+{
+    pid_t *pids;
+    int *fds, pipefd[2], i, running = 0;
+    trace_t *trace;
+    range_t *ranges = NULL;
+
+    if ((pids = (pid_t *)calloc(n, sizeof(pid_t))) == NULL ||
+	(fds = (int *)calloc(n, sizeof(int))) == NULL)
+	unix_error("calloc failed in eval_mm_parallel");
+
+    for (i = 0; i < n; i++) {
+	if (running == num_jobs) {
+	    reap_worker(pids, fds, n, stats);
+	    running--;
+	}
+	fflush(stdout);  /* or the worker prints it again */
+	if (pipe(pipefd) < 0)
+	    unix_error("pipe failed in eval_mm_parallel");
+	if ((pids[i] = fork()) < 0)
+	    unix_error("fork failed in eval_mm_parallel");
+	if (pids[i] == 0) {
+	    close(pipefd[0]);
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    stats[i].ops = trace->num_ops;
+	    stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	    if (stats[i].valid)
+		stats[i].util = eval_mm_util(trace, i, &ranges, &stats[i]);
+	    fflush(stdout);
+	    if (write(pipefd[1], &stats[i], sizeof(stats_t)) != sizeof(stats_t) ||
+		write(pipefd[1], &errors, sizeof(errors)) != sizeof(errors))
+		_exit(1);
+	    _exit(0);
+	}
+	close(pipefd[1]);
+	fds[i] = pipefd[0];
+	running++;
+    }
+    while (running-- > 0)
+	reap_worker(pids, fds, n, stats);
+
+    free(pids);
+    free(fds);
+}
+
+/*
+ * reap_worker - Wait for a worker of eval_mm_parallel to finish and
+ *    merge its results. A worker that died doesn't take mdriver down,
+ *    its trace counts as one that isn't valid.
+ */
+static void reap_worker(pid_t *pids, int *fds, int n, stats_t *stats)
+{
+    pid_t pid;
+    int i, status, worker_errors;
+    stats_t result;
+
+    if ((pid = wait(&status)) < 0)
+	unix_error("wait failed in reap_worker");
+    for (i = 0; i < n && pids[i] != pid; i++)
+	;
+    if (i == n)
+	return;  /* some other child */
+    pids[i] = 0;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+	read(fds[i], &result, sizeof(result)) == sizeof(result) &&
+	read(fds[i], &worker_errors, sizeof(worker_errors)) == 
+	sizeof(worker_errors)) {
+	stats[i] = result;
+	errors += worker_errors;
+    }
+    else {
+	if (WIFSIGNALED(status))
+	    sprintf(msg, "The worker checking it died of signal %d", 
+		    WTERMSIG(status));
+	else
+	    sprintf(msg, "The worker checking it failed");
+	errors++;
+	printf("ERROR [trace %d]: %s\n", i, msg);
+	stats[i].valid = 0;
+    }
+    close(fds[i]);
+}
+
+/*
+ * eval_mm_threads - Replay the trace with num_threads threads at once.
+ *    Block id k is allocated and reallocated by thread k % num_threads
+ *    and freed by the thread after it, so the allocator also sees
+ *    frees of blocks that another thread allocated. A request waits
+ *    until the earlier requests on its id are done. With -c every
+ *    thread instead replays all of the trace on blocks of its own.
+ */
+static void eval_mm_threads(trace_t *trace, mt_stats_t *stats)
+{
+    int i, t, run, index;
+    int *counts;         /* per id, number of requests dealt out so far */
+    int *done;
+    double *lat;         /* secs per request of each thread in some run */
+    double begin, end;
+    replay_t *replays, *r;
+    pthread_t *tids;
+    pthread_barrier_t start;
+
+    if ((replays = (replay_t *)calloc(num_threads, sizeof(replay_t))) == NULL ||
+	(tids = (pthread_t *)malloc(num_threads * sizeof(pthread_t))) == NULL ||
+	(lat = (double *)malloc(num_threads * sizeof(double))) == NULL ||
+	(counts = (int *)calloc(trace->num_ids, sizeof(int))) == NULL ||
+	(done = (int *)calloc(trace->num_ids, sizeof(int))) == NULL)
+	unix_error("malloc failed in eval_mm_threads");
+
+    for (t = 0; t < num_threads; t++) {
+	r = &replays[t];
+	r->trace = trace;
+	r->start = &start;
+	r->done = copy_trace ? NULL : done;
+	r->blocks = trace->blocks;
+	if ((r->ops = (int *)malloc(trace->num_ops * sizeof(int))) == NULL ||
+	    (r->seqs = (int *)malloc(trace->num_ops * sizeof(int))) == NULL ||
+	    (copy_trace && (r->blocks = 
+			    (char **)malloc(trace->num_ids * sizeof(char *))) == NULL))
+	    unix_error("malloc failed in eval_mm_threads");
+    }
+
+    /* Deal out the requests, every thread gets them in trace order */
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	for (t = 0; t < num_threads; t++) {
+	    if (!copy_trace) {
+		t = index % num_threads;
+		if (trace->ops[i].type == FREE)
+		    t = (t + 1) % num_threads;
+	    }
+	    r = &replays[t];
+	    r->ops[r->num_ops] = i;
+	    r->seqs[r->num_ops++] = counts[index];
+	    if (!copy_trace)
+		break;
+	}
+	counts[index]++;
+    }
+
+    stats->valid = 1;
+    stats->ops = trace->num_ops;
+    if (copy_trace)
+	stats->ops *= num_threads;
+    stats->secs = DBL_MAX;
+    for (run = 0; run < MT_RUNS; run++) {
+	mem_reset_brk();
+	if (mm_init() < 0) 
+	    app_error("mm_init failed in eval_mm_threads");
+	memset(done, 0, trace->num_ids * sizeof(int));
+
+	if (pthread_barrier_init(&start, NULL, num_threads + 1) != 0)
+	    app_error("pthread_barrier_init failed in eval_mm_threads");
+	for (t = 0; t < num_threads; t++)
+	    if (pthread_create(&tids[t], NULL, replay_thread, &replays[t]) != 0)
+		app_error("pthread_create failed in eval_mm_threads");
+	pthread_barrier_wait(&start);
+	for (t = 0; t < num_threads; t++)
+	    pthread_join(tids[t], NULL);
+	pthread_barrier_destroy(&start);
+
+	/* The run lasts from the first thread's start to the last one's end */
+	begin = DBL_MAX;
+	end = 0;
+	for (t = 0; t < num_threads; t++) {
+	    begin = (replays[t].begin < begin) ? replays[t].begin : begin;
+	    end = (replays[t].end > end) ? replays[t].end : end;
+	}
+
+	/* Keep the latencies of the fastest run */
+	if (end - begin < stats->secs) {
+	    stats->secs = end - begin;
+	    stats->min_lat = DBL_MAX;
+	    stats->avg_lat = 0;
+	    stats->max_lat = 0;
+	    for (t = 0; t < num_threads; t++) {
+		r = &replays[t];
+		lat[t] = (r->num_ops > 0) ? (r->end - r->begin) / r->num_ops : 0;
+		stats->min_lat = (lat[t] < stats->min_lat) ? lat[t] : stats->min_lat;
+		stats->max_lat = (lat[t] > stats->max_lat) ? lat[t] : stats->max_lat;
+		stats->avg_lat += lat[t] / num_threads;
+	    }
+	}
+    }
+
+    if (verbose > 1)
+	for (t = 0; t < num_threads; t++)
+	    printf("  thread %2d: %8d ops %8.0f ns/op\n", 
+		   t, replays[t].num_ops, lat[t] * 1e9);
+
+    for (t = 0; t < num_threads; t++) {
+	free(replays[t].ops);
+	free(replays[t].seqs);
+	if (copy_trace)
+	    free(replays[t].blocks);
+    }
+    free(replays);
+    free(tids);
+    free(lat);
+    free(counts);
+    free(done);
+}
+
+/*
+ * replay_thread - Make the requests of one thread's share of a trace
+ */
+static void *replay_thread(void *ptr)
+{
+    replay_t *r = (replay_t *)ptr;
+    traceop_t *op;
+    int i, index;
+
+    pthread_barrier_wait(r->start);
+    r->begin = wall_secs();
+    for (i = 0;  i < r->num_ops;  i++) {
+	op = &r->trace->ops[r->ops[i]];
+	index = op->index;
+
+	/* Wait for the requests on this id that come earlier in the trace */
+	if (r->done != NULL)
+	    while (__atomic_load_n(&r->done[index], __ATOMIC_ACQUIRE) != r->seqs[i])
+		sched_yield();
+
+        switch (op->type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((r->blocks[index] = mm_malloc(op->size)) == NULL)
+		app_error("mm_malloc error in replay_thread");
+            break;
+
+        case MEMALIGN: /* mm_memalign */
+            if ((r->blocks[index] = mm_memalign(op->align, op->size)) == NULL)
+		app_error("mm_memalign error in replay_thread");
+            break;
+
+        case CALLOC: /* mm_calloc */
+            if ((r->blocks[index] = mm_calloc(1, op->size)) == NULL)
+		app_error("mm_calloc error in replay_thread");
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((r->blocks[index] = mm_realloc(r->blocks[index], 
+					       op->size)) == NULL)
+		app_error("mm_realloc error in replay_thread");
+            break;
+
+        case FREE: /* mm_free */
+            mm_free(r->blocks[index]);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in replay_thread");
+        }
+
+	if (r->done != NULL)
+	    __atomic_store_n(&r->done[index], r->seqs[i] + 1, __ATOMIC_RELEASE);
+    }
+    r->end = wall_secs();
+    return NULL;
+}
+
+/*
+ * wall_secs - Wall clock time in seconds
+ */
+static double wall_secs(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * eval_mm_latency - Replay the trace once more and read the cycle
+ *    counter around every request. The overhead of reading the counter
+ *    is measured first and taken off, and the histograms are fixed
+ *    arrays, so the timing costs little more than two rdtscs a request.
+ */
+static void eval_mm_latency(trace_t *trace, lat_stats_t *stats)
+{
+    int i, index;
+    unsigned long long start, cycles, ovhd = counter_overhead();
+    traceop_t *op;
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	op = &trace->ops[i];
+	index = op->index;
+
+        switch (op->type) {
+
+        case ALLOC: /* mm_malloc */
+	    start = read_counter();
+            trace->blocks[index] = mm_malloc(op->size);
+	    cycles = read_counter() - start;
+            if (trace->blocks[index] == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+            break;
+
+        case MEMALIGN: /* mm_memalign */
+	    start = read_counter();
+            trace->blocks[index] = mm_memalign(op->align, op->size);
+	    cycles = read_counter() - start;
+            if (trace->blocks[index] == NULL)
+		app_error("mm_memalign error in eval_mm_latency");
+            break;
+
+        case CALLOC: /* mm_calloc */
+	    start = read_counter();
+            trace->blocks[index] = mm_calloc(1, op->size);
+	    cycles = read_counter() - start;
+            if (trace->blocks[index] == NULL)
+		app_error("mm_calloc error in eval_mm_latency");
+            break;
+
+	case REALLOC: /* mm_realloc */
+	    start = read_counter();
+            trace->blocks[index] = mm_realloc(trace->blocks[index], op->size);
+	    cycles = read_counter() - start;
+            if (trace->blocks[index] == NULL)
+		app_error("mm_realloc error in eval_mm_latency");
+            break;
+
+        case FREE: /* mm_free */
+	    start = read_counter();
+            mm_free(trace->blocks[index]);
+	    cycles = read_counter() - start;
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+        }
+
+	hist_add(&stats->hists[op->type], (cycles > ovhd) ? cycles - ovhd : 0);
+    }
+    stats->valid = 1;
+}
+
+/*
+ * hist_add - Count a request of the given number of cycles. Below 4
+ *    every value has a bucket of its own, above it the 2 bits after
+ *    the leading one pick one of 4 buckets for each power of two.
+ */
+static void hist_add(hist_t *hist, unsigned long long cycles)
+{
+    int msb, bucket;
+
+    if (cycles < 4)
+	bucket = cycles;
+    else {
+	msb = 63 - __builtin_clzll(cycles);
+	bucket = 4 * (msb - 1) + ((cycles >> (msb - 2)) & 3);
+    }
+    hist->counts[bucket]++;
+    hist->n++;
+    if (cycles > hist->max)
+	hist->max = cycles;
+}
+
+/*
+ * hist_merge - Add the requests counted in from to those in to
+ */
+static void hist_merge(hist_t *to, hist_t *from)
+{
+    int b;
+
+    to->n += from->n;
+    for (b = 0; b < HIST_BUCKETS; b++)
+	to->counts[b] += from->counts[b];
+    if (from->max > to->max)
+	to->max = from->max;
+}
+
+/*
+ * hist_percentile - Return an upper bound for the latency that a fraction 
+ *    p of the requests didn't exceed, i.e. the top of its bucket
+ */
+static unsigned long long hist_percentile(hist_t *hist, double p)
+{
+    int bucket, shift;
+    double seen = 0;
+    unsigned long long top;
+
+    for (bucket = 0; bucket < HIST_BUCKETS; bucket++) {
+	seen += hist->counts[bucket];
+	if (seen >= p * hist->n)
+	    break;
+    }
+    if (bucket < 4)
+	top = bucket;
+    else {
+	shift = bucket / 4 - 1;
+	top = ((unsigned long long)(4 + bucket % 4 + 1) << shift) - 1;
+    }
+    return (top < hist->max) ? top : hist->max;
+}
+
+/*
+ * counter_overhead - Return the cycles of reading the counter, the 
+ *    cheapest of a few back to back reads, to take off every request
+ */
+static unsigned long long counter_overhead(void)
+{
+    int i;
+    unsigned long long start, cycles, ovhd = ~0ULL;
+
+    for (i = 0; i < 100; i++) {
+	start = read_counter();
+	cycles = read_counter() - start;
+	ovhd = (cycles < ovhd) ? cycles : ovhd;
+    }
+    return ovhd;
+}
+
+/*
+ * eval_cold - Replay the trace with mm, or ref if it isn't NULL, under
+ *    cache pressure. The replay runs in a child process of its own, so
+ *    every allocator starts out cold: no memory from the system yet, 
+ *    and nothing of it in the caches.
+ */
+static void eval_cold(ref_t *ref, trace_t *trace, stats_t *stats)
+{
+    speed_t params;
+    child_t child;
+
+    params.trace = trace;
+    params.ranges = NULL;
+    params.ref = ref;
+    child.params = &params;
+    child.tracenum = 0;
+    child.stats = stats;
+    if (run_child(cold_child, &child) != 0)
+	stats->cold.valid = 0;
+}
+
+/*
+ * cold_child - The part of eval_cold in the child process. The buffer 
+ *    is thrashed before the first request and again after every 
+ *    pressure_every of them, which stands in for the other work of a 
+ *    program between its mallocs and frees. Only the requests are timed,
+ *    like eval_mm_latency does.
+ */
+static void cold_child(child_t *child)
+{
+    speed_t *params = child->params;
+    trace_t *trace = params->trace;
+    cold_t *cold = &child->stats->cold;
+    unsigned long long start, cycles, ovhd;
+    char *buf;
+    int i;
+
+    if ((buf = mmap(NULL, pressure_bytes, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+	unix_error("mmap failed in cold_child");
+    if (params->ref == NULL) {
+	/* Fresh storage for the heaps, see mm_rss_child */
+	mem_deinit();
+	if (backend == MEM_BACKEND_MALLOC)
+	    mem_set_backend(MEM_BACKEND_MMAP);
+	mem_init();
+    }
+    else if (params->ref->path != NULL)
+	load_ref(params->ref);
+    memset(cold, 0, sizeof(cold_t));
+    ovhd = counter_overhead();
+
+    thrash(buf);
+    if (params->ref == NULL) {
+	start = read_counter();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in cold_child");
+	cold->start = read_counter() - start;
+    }
+    for (i = 0; i < trace->num_ops; i++) {
+	if (i > 0 && i % pressure_every == 0)
+	    thrash(buf);
+	start = read_counter();
+	cold_request(params->ref, trace, &trace->ops[i]);
+	cycles = read_counter() - start;
+	cycles = (cycles > ovhd) ? cycles - ovhd : 0;
+	hist_add(&cold->hist, cycles);
+	cold->cycles += cycles;
+	if (i < COLD_START_OPS)
+	    cold->start += cycles;
+    }
+    cold->valid = 1;
+}
+
+/*
+ * cold_request - Make one request of the trace with mm, or ref if it 
+ *    isn't NULL. The allocators were checked already, so a failure ends
+ *    the child process.
+ */
+static void cold_request(ref_t *ref, trace_t *trace, traceop_t *op)
+{
+    char **block = &trace->blocks[op->index];
+    void *p = NULL;
+
+    switch (op->type) {
+    case ALLOC: /* malloc */
+	p = (ref != NULL) ? ref->malloc_fn(op->size) : mm_malloc(op->size);
+	break;
+
+    case MEMALIGN: /* memalign */
+	if (ref == NULL)
+	    p = mm_memalign(op->align, op->size);
+	else if (ref->memalign_fn(&p, op->align, op->size) != 0)
+	    p = NULL;
+	break;
+
+    case CALLOC: /* calloc */
+	p = (ref != NULL) ? ref->calloc_fn(1, op->size) : mm_calloc(1, op->size);
+	break;
+
+    case REALLOC: /* realloc */
+	p = (ref != NULL) ? ref->realloc_fn(*block, op->size) : 
+	    mm_realloc(*block, op->size);
+	break;
+
+    case FREE: /* free */
+	if (ref != NULL)
+	    ref->free_fn(*block);
+	else
+	    mm_free(*block);
+	return;
+
+    default:
+	app_error("Nonexistent request type in cold_request");
+    }
+    if (p == NULL)
+	app_error("request failed in cold_request");
+    *block = p;
+}
+
+/*
+ * thrash - Write a byte of every cache line of buf, which evicts what
+ *    the allocator had in the caches and its pages from the TLB
+ */
+static void thrash(volatile char *buf)
+{
+    size_t i;
+
+    for (i = 0; i < pressure_bytes; i += CACHE_LINE)
+	buf[i]++;
+}
+
+/*
+ * eval_mm_batch - Replay the trace with the batch API of the mm package.
+ *    A run of mallocs of the same size becomes one mm_malloc_batch, a
+ *    run of frees one mm_free_batch. The first replay checks the blocks
+ *    against the range tree, the timed ones don't.
+ */
+static void eval_mm_batch(trace_t *trace, int tracenum, range_t **ranges,
+			  batch_stats_t *stats)
+{
+    int i, n, longest = 1;
+    traceop_t *op;
+    batch_t batch;
+
+    batch.trace = trace;
+    batch.tracenum = tracenum;
+    if ((batch.runs = (int *)malloc(trace->num_ops * sizeof(int) + 1)) == NULL)
+	unix_error("malloc 1 failed in eval_mm_batch");
+
+    /* Group the requests into runs */
+    stats->ops = trace->num_ops;
+    stats->runs = 0;
+    for (i = 0; i < trace->num_ops; i += n) {
+	op = &trace->ops[i];
+	for (n = 1; i + n < trace->num_ops && 
+		 (op->type == ALLOC || op->type == FREE); n++)
+	    if (op[n].type != op->type || 
+		(op->type == ALLOC && op[n].size != op->size))
+		break;
+	batch.runs[i] = n;
+	longest = MAX(longest, n);
+	stats->runs++;
+    }
+    if ((batch.ptrs = (void **)malloc(longest * sizeof(void *))) == NULL)
+	unix_error("malloc 2 failed in eval_mm_batch");
+
+    batch.ranges = ranges;
+    stats->valid = replay_batch(&batch);
+    if (stats->valid) {
+	batch.ranges = NULL;
+	stats->secs = fsecs(eval_mm_batch_speed, &batch);
+    }
+
+    free(batch.runs);
+    free(batch.ptrs);
+}
+
+/*
+ * eval_mm_batch_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the batch replay.
+ */
+static void eval_mm_batch_speed(void *ptr)
+{
+    if (!replay_batch((batch_t *)ptr))
+	app_error("replay_batch failed in eval_mm_batch_speed");
+}
+
+/*
+ * replay_batch - Replay the runs of the trace once. Single requests go
+ *    to the ordinary interface. Returns 0 if a request failed.
+ */
+static int replay_batch(batch_t *batch)
+{
+    int i, j, n;
+    traceop_t *op;
+    trace_t *trace = batch->trace;
+    void **ptrs = batch->ptrs;
+    char *p;
+
+    mem_reset_brk();
+    if (batch->ranges != NULL)
+	clear_ranges(batch->ranges);
+    if (mm_init() < 0) {
+	malloc_error(batch->tracenum, 0, "mm_init failed.");
+	return 0;
+    }
+
+    for (i = 0;  i < trace->num_ops;  i += n) {
+	op = &trace->ops[i];
+	n = batch->runs[i];
+
+        switch (op->type) {
+
+        case ALLOC: /* mm_malloc_batch */
+	    if (n > 1) {
+		if (mm_malloc_batch(op->size, n, ptrs) < n) {
+		    malloc_error(batch->tracenum, i, "mm_malloc_batch failed.");
+		    return 0;
+		}
+	    }
+	    else if ((ptrs[0] = mm_malloc(op->size)) == NULL) {
+		malloc_error(batch->tracenum, i, "mm_malloc failed.");
+		return 0;
+	    }
+	    for (j = 0; j < n; j++) {
+		if (batch->ranges != NULL &&
+		    add_range(batch->ranges, ptrs[j], op[j].size, 
+			      batch->tracenum, i + j) == 0)
+		    return 0;
+		trace->blocks[op[j].index] = ptrs[j];
+	    }
+	    break;
+
+	case MEMALIGN: /* mm_memalign */
+	    if ((p = mm_memalign(op->align, op->size)) == NULL) {
+		malloc_error(batch->tracenum, i, "mm_memalign failed.");
+		return 0;
+	    }
+	    if (batch->ranges != NULL &&
+		add_range(batch->ranges, p, op->size, batch->tracenum, i) == 0)
+		return 0;
+	    trace->blocks[op->index] = p;
+	    break;
+
+	case CALLOC: /* mm_calloc */
+	    if ((p = mm_calloc(1, op->size)) == NULL) {
+		malloc_error(batch->tracenum, i, "mm_calloc failed.");
+		return 0;
+	    }
+	    if (batch->ranges != NULL &&
+		add_range(batch->ranges, p, op->size, batch->tracenum, i) == 0)
+		return 0;
+	    trace->blocks[op->index] = p;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(trace->blocks[op->index], op->size)) == NULL) {
+		malloc_error(batch->tracenum, i, "mm_realloc failed.");
+		return 0;
+	    }
+	    if (batch->ranges != NULL) {
+		remove_range(batch->ranges, trace->blocks[op->index]);
+		if (add_range(batch->ranges, p, op->size, 
+			      batch->tracenum, i) == 0)
+		    return 0;
+	    }
+	    trace->blocks[op->index] = p;
+	    break;
+
+        case FREE: /* mm_free_batch */
+	    for (j = 0; j < n; j++) {
+		ptrs[j] = trace->blocks[op[j].index];
+		if (batch->ranges != NULL)
+		    remove_range(batch->ranges, ptrs[j]);
+	    }
+	    if (n > 1)
+		mm_free_batch(n, ptrs);
+	    else
+		mm_free(ptrs[0]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in replay_batch");
+        }
+    }
+    return 1;
+}
+
+/*
+ * add_ref - Add the malloc of the shared library at path, or libc malloc
+ *    if path is NULL, to the reference allocators unless it is there
+ *    already. Its name is the file name without ".so" and, unless that 
+ *    leaves too little, "lib" (libc.so.6 stays libc).
+ */
+static ref_t *add_ref(char *path)
+{
+    ref_t *ref;
+    char *name, *end;
+    int r;
+
+    if (path != NULL && (!strcmp(path, "libc") || !strcmp(path, "glibc")))
+	path = NULL;
+    for (r = 0; r < num_refs; r++)
+	if ((path == NULL && refs[r].path == NULL) ||
+	    (path != NULL && refs[r].path != NULL && !strcmp(path, refs[r].path)))
+	    return &refs[r];
+    if (num_refs == MAX_REFS) {
+	fprintf(stderr, "At most %d reference allocators\n", MAX_REFS);
+	exit(1);
+    }
+
+    ref = &refs[num_refs++];
+    memset(ref, 0, sizeof(*ref));
+    if (path == NULL) {
+	ref->name = "libc";
+	ref->malloc_fn = malloc;
+	ref->free_fn = free;
+	ref->realloc_fn = realloc;
+	ref->calloc_fn = calloc;
+	ref->memalign_fn = posix_memalign;
+	return ref;
+    }
+
+    ref->path = path;
+    name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    if ((name = strdup(name)) == NULL)
+	unix_error("strdup failed in add_ref");
+    if ((end = strstr(name, ".so")) != NULL && end != name)
+	*end = '\0';
+    ref->name = (!strncmp(name, "lib", 3) && strlen(name) > 4) ? name + 3 : name;
+    return ref;
+}
+
+/*
+ * load_ref - Load the library of a reference allocator and look up its
+ *    functions. Called in the child processes only, so that each of
+ *    them starts with a fresh allocator and mdriver's own malloc stays
+ *    the one of libc.
+ */
+static void load_ref(ref_t *ref)
+{
+    void *lib;
+
+    if ((lib = dlopen(ref->path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+	printf("Could not load %s: %s\n", ref->path, dlerror());
+	fflush(stdout);
+	_exit(2);
+    }
+    ref->malloc_fn = (void *(*)(size_t))dlsym(lib, "malloc");
+    ref->free_fn = (void (*)(void *))dlsym(lib, "free");
+    ref->realloc_fn = (void *(*)(void *, size_t))dlsym(lib, "realloc");
+    ref->calloc_fn = (void *(*)(size_t, size_t))dlsym(lib, "calloc");
+    ref->memalign_fn = (int (*)(void **, size_t, size_t))
+	dlsym(lib, "posix_memalign");
+    if (!ref->malloc_fn || !ref->free_fn || !ref->realloc_fn || 
+	!ref->calloc_fn || !ref->memalign_fn) {
+	printf("%s lacks one of malloc, free, realloc, calloc and "
+	       "posix_memalign\n", ref->path);
+	fflush(stdout);
+	_exit(2);
+    }
+}
+
+/*
+ * eval_ref - Check, time and measure the memory of a reference allocator
+ *    on the trace in a child process, where a crash can't take mdriver 
+ *    down and the allocator starts out empty
+ */
+static void eval_ref(ref_t *ref, trace_t *trace, int tracenum, stats_t *stats)
+{
+    speed_t params;
+    child_t child;
+    int status;
+
+    params.trace = trace;
+    params.ranges = NULL;
+    params.ref = ref;
+    child.params = &params;
+    child.tracenum = tracenum;
+    child.stats = stats;
+    if ((status = run_child(ref_child, &child)) == 2)
+	exit(1);
+    if (status != 0) {
+	printf("%s malloc failed on trace %d\n", ref->name, tracenum);
+	stats->valid = 0;
+    }
+}
+
+/*
+ * ref_child - The part of eval_ref in the child process. The resident
+ *    set is measured over the first replay, while the allocator still
+ *    has to get all of its memory from the system.
+ */
+static void ref_child(child_t *child)
+{
+    speed_t *params = child->params;
+    stats_t *stats = child->stats;
+    double rss;
+
+    if (params->ref->path != NULL)
+	load_ref(params->ref);
+    rss = reset_rss();
+    stats->valid = eval_ref_valid(params->trace, child->tracenum, params->ref);
+    stats->rss_peak = (rss < 0) ? -1 : vm_status("VmHWM:") - rss;
+    if (stats->valid)
+	stats->secs = fsecs(eval_ref_speed, params);
+}
+
+/*
+ * calibrate_thruput - Return the throughput of libc malloc over the
+ *    traces it ran correctly, the cap of the performance index, or 
+ *    AVG_LIBC_THRUPUT if it didn't run any
+ */
+static double calibrate_thruput(int n, stats_t **ref_stats)
+{
+    int r, i;
+    double ops = 0, secs = 0;
+
+    for (r = 0; r < num_refs && refs[r].path != NULL; r++)
+	;
+    if (r == num_refs)
+	return AVG_LIBC_THRUPUT;
+    for (i = 0; i < n; i++)
+	if (ref_stats[r][i].valid) {
+	    ops += ref_stats[r][i].ops;
+	    secs += ref_stats[r][i].secs;
+	}
+    return (secs > 0) ? ops / secs : AVG_LIBC_THRUPUT;
+}
+
+/*
+ * eval_ref_valid - We run this function to make sure that the
+ *    reference allocator can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any of its calls fails,
+ *    which ends the child process that eval_ref runs it in.
  *
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static int eval_ref_valid(trace_t *trace, int tracenum, ref_t *ref)
 {
     int i, newsize;
     char *p, *newp, *oldp;
@@ -840,8 +2692,25 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
+	    if ((p = ref->malloc_fn(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "reference malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case MEMALIGN: /* posix_memalign */
+	    if ((errno = ref->memalign_fn((void **)&p, trace->ops[i].align, 
+					trace->ops[i].size)) != 0) {
+		malloc_error(tracenum, i, "reference posix_memalign failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case CALLOC: /* calloc */
+	    if ((p = ref->calloc_fn(1, trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "reference calloc failed");
 		unix_error("System message");
 	    }
 	    trace->blocks[trace->ops[i].index] = p;
@@ -850,19 +2719,19 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
+	    if ((newp = ref->realloc_fn(oldp, newsize)) == NULL) {
+		malloc_error(tracenum, i, "reference realloc failed");
 		unix_error("System message");
 	    }
 	    trace->blocks[trace->ops[i].index] = newp;
 	    break;
 	    
         case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+	    ref->free_fn(trace->blocks[trace->ops[i].index]);
 	    break;
 
 	default:
-	    app_error("invalid operation type  in eval_libc_valid");
+	    app_error("invalid operation type  in eval_ref_valid");
 	}
     }
 
@@ -870,24 +2739,41 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 }
 
 /* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
+ * eval_ref_speed - This is the function that is used by fcyc() to
+ *    measure the running time of a reference allocator on the set
  *    of traces.
  */
-static void eval_libc_speed(void *ptr)
+static void eval_ref_speed(void *ptr)
 {
     int i;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    ref_t *ref = ((speed_t *)ptr)->ref;
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
+	    if ((p = ref->malloc_fn(size)) == NULL)
+		unix_error("malloc failed in eval_ref_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case MEMALIGN: /* posix_memalign */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if (ref->memalign_fn((void **)&p, trace->ops[i].align, size) != 0)
+		unix_error("posix_memalign failed in eval_ref_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case CALLOC: /* calloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = ref->calloc_fn(1, size)) == NULL)
+		unix_error("calloc failed in eval_ref_speed");
 	    trace->blocks[index] = p;
 	    break;
 
@@ -895,8 +2781,8 @@ static void eval_libc_speed(void *ptr)
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-	    if ((newp = realloc(oldp, newsize)) == NULL)
-		unix_error("realloc failed in eval_libc_speed\n");
+	    if ((newp = ref->realloc_fn(oldp, newsize)) == NULL)
+		unix_error("realloc failed in eval_ref_speed\n");
 	    
 	    trace->blocks[index] = newp;
 	    break;
@@ -904,10 +2790,87 @@ static void eval_libc_speed(void *ptr)
         case FREE: /* free */
 	    index = trace->ops[i].index;
 	    block = trace->blocks[index];
-	    free(block);
+	    ref->free_fn(block);
+	    break;
+	}
+    }
+}
+
+/*
+ * run_child - Call f in a child process and copy the stats it leaves in
+ *    child->stats back. Returns the exit status of the child, 0 if all
+ *    went well, or -1 if it died or sent nothing back.
+ */
+static int run_child(void (*f)(child_t *), child_t *child)
+{
+    int fds[2], status;
+    pid_t pid;
+    stats_t stats;
+    ssize_t n;
+
+    fflush(stdout);  /* or the child prints it again */
+    if (pipe(fds) < 0)
+	unix_error("pipe failed in run_child");
+    if ((pid = fork()) < 0)
+	unix_error("fork failed in run_child");
+    if (pid == 0) {
+	close(fds[0]);
+	f(child);
+	fflush(stdout);
+	n = write(fds[1], child->stats, sizeof(stats_t));
+	_exit(n == sizeof(stats_t) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    n = read(fds[0], &stats, sizeof(stats));
+    close(fds[0]);
+    if (waitpid(pid, &status, 0) < 0)
+	unix_error("waitpid failed in run_child");
+    if (!WIFEXITED(status))
+	return -1;
+    if (WEXITSTATUS(status) != 0)
+	return WEXITSTATUS(status);
+    if (n != sizeof(stats))
+	return -1;
+    *child->stats = stats;
+    return 0;
+}
+
+/*
+ * reset_rss - Reset the peak resident set size of this process to the
+ *    current one and return it in bytes, or -1 if Linux won't tell
+ */
+static double reset_rss(void)
+{
+    int fd;
+
+    if ((fd = open("/proc/self/clear_refs", O_WRONLY)) >= 0) {
+	if (write(fd, "5", 1) != 1) /* 5 resets VmHWM */
+	    fd = -1;
+	close(fd);
+    }
+    return (fd < 0) ? -1 : vm_status("VmRSS:");
+}
+
+/*
+ * vm_status - Return the size in bytes that the line of a field such as 
+ *    "VmHWM:" in /proc/self/status gives, or -1
+ */
+static double vm_status(char *field)
+{
+    FILE *fp;
+    char line[MAXLINE];
+    double kb = -1;
+
+    if ((fp = fopen("/proc/self/status", "r")) == NULL)
+	return -1;
+    while (fgets(line, sizeof(line), fp) != NULL)
+	if (!strncmp(line, field, strlen(field))) {
+	    kb = atof(line + strlen(field));
 	    break;
 	}
-    }
+    fclose(fp);
+    return (kb < 0) ? -1 : kb * 1024;
 }
 
 /*************************************
@@ -972,6 +2935,789 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printresults_mt - prints a summary of the multithreaded replays, with
+ *     the min/avg/max over the threads of their average latency per request
+ */
+static void printresults_mt(int n, mt_stats_t *stats) 
+{
+    int i, valid = 0;
+    double secs = 0;
+    double ops = 0;
+    double min_lat = DBL_MAX, avg_lat = 0, max_lat = 0;
+
+    printf("%5s%10s%10s%8s%9s%9s%9s\n", 
+	   "trace", "ops", "secs", "Kops", "min ns", "avg ns", "max ns");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%13.0f%10.6f%8.0f%9.0f%9.0f%9.0f\n", 
+		   i,
+		   stats[i].ops,
+		   stats[i].secs,
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   stats[i].min_lat*1e9,
+		   stats[i].avg_lat*1e9,
+		   stats[i].max_lat*1e9);
+	    secs += stats[i].secs;
+	    ops += stats[i].ops;
+	    min_lat = (stats[i].min_lat < min_lat) ? stats[i].min_lat : min_lat;
+	    max_lat = (stats[i].max_lat > max_lat) ? stats[i].max_lat : max_lat;
+	    avg_lat += stats[i].avg_lat;
+	    valid++;
+	}
+	else {
+	    printf("%2d%13s%10s%8s%9s%9s%9s\n", 
+		   i, "-", "-", "-", "-", "-", "-");
+	}
+    }
+
+    /* Print the aggregate results for the set of traces */
+    if (valid > 0) {
+	printf("%5s%10.0f%10.6f%8.0f%9.0f%9.0f%9.0f\n", 
+	       "Total",
+	       ops, 
+	       secs,
+	       (ops/1e3)/secs,
+	       min_lat*1e9,
+	       (avg_lat/valid)*1e9,
+	       max_lat*1e9);
+    }
+}
+
+/*
+ * printresults_lat - prints the latency percentiles of every request
+ *     type for each trace, and for all of the traces together
+ */
+static void printresults_lat(int n, lat_stats_t *stats) 
+{
+    int i, type;
+    hist_t *hist, total[5];
+
+    memset(total, 0, sizeof(total));
+    printf("%5s%9s%9s%8s%8s%8s%8s%10s\n", 
+	   "trace", "op", "n", "p50", "p90", "p99", "p99.9", "max");
+    for (i=0; i <= n; i++) {
+	if (i < n && !stats[i].valid) {
+	    printf("%2d%12s%9s%8s%8s%8s%8s%10s\n", 
+		   i, "-", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	for (type = ALLOC; type <= CALLOC; type++) {
+	    hist = (i < n) ? &stats[i].hists[type] : &total[type];
+	    if (hist->n == 0)
+		continue;
+	    if (i < n)
+		printf("%2d%12s", i, op_names[type]);
+	    else
+		printf("%5s%9s", "Total", op_names[type]);
+	    printf("%9.0f%8llu%8llu%8llu%8llu%10llu\n", 
+		   hist->n,
+		   hist_percentile(hist, 0.50),
+		   hist_percentile(hist, 0.90),
+		   hist_percentile(hist, 0.99),
+		   hist_percentile(hist, 0.999),
+		   hist->max);
+
+	    /* Add the trace's requests to the totals */
+	    if (i < n)
+		hist_merge(&total[type], hist);
+	}
+    }
+}
+
+/*
+ * printresults_batch - prints a summary of the batch replays, with the
+ *     speedup over the replay with single requests
+ */
+static void printresults_batch(int n, batch_stats_t *stats, stats_t *mm_stats) 
+{
+    int i;
+    double secs = 0, mm_secs = 0;
+    double ops = 0, runs = 0;
+
+    printf("%5s%10s%10s%10s%8s%9s\n", 
+	   "trace", "ops", "calls", "secs", "Kops", "speedup");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%13.0f%10.0f%10.6f%8.0f%8.2fx\n", 
+		   i,
+		   stats[i].ops,
+		   stats[i].runs,
+		   stats[i].secs,
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   mm_stats[i].secs/stats[i].secs);
+	    secs += stats[i].secs;
+	    mm_secs += mm_stats[i].secs;
+	    ops += stats[i].ops;
+	    runs += stats[i].runs;
+	}
+	else {
+	    printf("%2d%13s%10s%10s%8s%9s\n", 
+		   i, "-", "-", "-", "-", "-");
+	}
+    }
+
+    /* Print the aggregate results for the set of traces */
+    if (secs > 0) {
+	printf("%5s%10.0f%10.0f%10.6f%8.0f%8.2fx\n", 
+	       "Total",
+	       ops, 
+	       runs,
+	       secs,
+	       (ops/1e3)/secs,
+	       mm_secs/secs);
+    }
+}
+
+/*
+ * printresults_perf - prints the hardware events that a replay of each
+ *     trace caused, per request so that the traces can be compared.
+ *     Events that the machine can't count are shown as "-".
+ */
+static void printresults_perf(int n, stats_t *stats) 
+{
+    static char *heads[PERFCTR_NUM] = 
+	{"instrs", "l1d", "llc", "dtlb", "branch", "faults"};
+    int i, e;
+
+    printf("%5s%10s", "trace", heads[0]);
+    for (e = 1; e < PERFCTR_NUM; e++)
+	printf("%8s", heads[e]);
+    printf("\n");
+    for (i=0; i < n; i++) {
+	printf("%2d", i);
+	for (e = 0; e < PERFCTR_NUM; e++) {
+	    if (!stats[i].valid || stats[i].perf[e] < 0)
+		printf((e == 0) ? "%13s" : "%8s", "-");
+	    else if (e == 0)
+		printf("%13.0f", stats[i].perf[e] / stats[i].ops);
+	    else
+		printf("%8.3f", stats[i].perf[e] / stats[i].ops);
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * printresults_frag - prints the free blocks of mm malloc at the tenth
+ *     of each trace with the most live bytes: at which request that was,
+ *     how many free blocks and bytes there were, which share of the free
+ *     bytes the largest block had, and how many free blocks of each size
+ */
+static void printresults_frag(int n, stats_t *stats) 
+{
+    static char *heads[FRAG_BUCKETS] = 
+	{"<64", "<256", "<1K", "<4K", "<16K", "<64K", ">=64K"};
+    frag_t *f;
+    int i, b;
+
+    printf("%5s%7s%8s%8s%9s", "trace", "at op", "free", "KB", "largest%");
+    for (b = 0; b < FRAG_BUCKETS; b++)
+	printf("%7s", heads[b]);
+    printf("\n");
+    for (i=0; i < n; i++) {
+	f = &stats[i].frag;
+	if (!stats[i].valid) {
+	    printf("%2d%10s\n", i, "-");
+	    continue;
+	}
+	printf("%2d%10.0f%8.0f%8.0f%9.1f", i, f->op, f->free_blocks, 
+	       f->free_bytes/1024, 
+	       f->free_bytes ? 100.0*f->largest/f->free_bytes : 0.0);
+	for (b = 0; b < FRAG_BUCKETS; b++)
+	    printf("%7.0f", f->hist[b]);
+	printf("\n");
+    }
+}
+
+/*
+ * printresults_refs - prints the throughput and the growth of the
+ *     resident set of mm malloc and of each reference allocator that
+ *     -l and -R asked for, side by side
+ */
+static void printresults_refs(int n, stats_t *mm_stats, stats_t **ref_stats) 
+{
+    int i, r, a;
+    stats_t *all[MAX_REFS + 1], *st;
+    char *names[MAX_REFS + 1];
+    double ops[MAX_REFS + 1], secs[MAX_REFS + 1], rss[MAX_REFS + 1];
+    int num = 0;
+
+    all[num] = mm_stats;
+    names[num++] = "mm.c";
+    for (r = 0; r < num_refs; r++)
+	if (refs[r].shown) {
+	    all[num] = ref_stats[r];
+	    names[num++] = refs[r].name;
+	}
+
+    printf("%5s", "trace");
+    for (a = 0; a < num; a++)
+	printf("%*.15s", (a == 0) ? 14 : 16, names[a]);
+    printf("\n%5s", "");
+    for (a = 0; a < num; a++)
+	printf("%*s%8s", (a == 0) ? 6 : 8, "Kops", "RSS");
+    printf("\n");
+    for (a = 0; a < num; a++)
+	ops[a] = secs[a] = rss[a] = 0;
+
+    for (i=0; i < n; i++) {
+	printf("%2d", i);
+	for (a = 0; a < num; a++) {
+	    st = &all[a][i];
+	    if (!st->valid) {
+		printf("%*s%8s", (a == 0) ? 9 : 8, "-", "-");
+		continue;
+	    }
+	    printf("%*.0f", (a == 0) ? 9 : 8, (st->ops/1e3)/st->secs);
+	    if (st->rss_peak < 0)
+		printf("%8s", "-");
+	    else
+		printf("%8.0f", st->rss_peak/1024);
+	    ops[a] += st->ops;
+	    secs[a] += st->secs;
+	    rss[a] = MAX(rss[a], st->rss_peak);
+	}
+	printf("\n");
+    }
+
+    /* Print the aggregate results, the largest resident set for the RSS */
+    printf("%5s", "Total");
+    for (a = 0; a < num; a++)
+	if (secs[a] > 0)
+	    printf("%*.0f%8.0f", (a == 0) ? 6 : 8, (ops[a]/1e3)/secs[a], 
+		   rss[a]/1024);
+	else
+	    printf("%*s%8s", (a == 0) ? 6 : 8, "-", "-");
+    printf("\n");
+}
+
+/*
+ * printresults_cold - prints the average and the p99 cycles per request
+ *     of mm malloc and the reference allocators under cache pressure,
+ *     and over the cold start, then ranks them by the average
+ */
+static void printresults_cold(int n, stats_t *mm_stats, stats_t **ref_stats) 
+{
+    int i, r, a, b;
+    stats_t *all[MAX_REFS + 1];
+    char *names[MAX_REFS + 1];
+    cold_t *cold, total[MAX_REFS + 1];
+    double starts[MAX_REFS + 1], avg[MAX_REFS + 1];
+    int order[MAX_REFS + 1], num = 0;
+
+    all[num] = mm_stats;
+    names[num++] = "mm.c";
+    for (r = 0; r < num_refs; r++)
+	if (refs[r].shown) {
+	    all[num] = ref_stats[r];
+	    names[num++] = refs[r].name;
+	}
+    memset(total, 0, sizeof(total));
+    memset(starts, 0, sizeof(starts));
+
+    printf("%5s", "trace");
+    for (a = 0; a < num; a++)
+	printf("%*.23s", (a == 0) ? 20 : 24, names[a]);
+    printf("\n%5s", "");
+    for (a = 0; a < num; a++)
+	printf("%*s%8s%8s", (a == 0) ? 4 : 8, "avg", "p99", "start");
+    printf("\n");
+
+    for (i=0; i < n; i++) {
+	printf("%2d", i);
+	for (a = 0; a < num; a++) {
+	    cold = &all[a][i].cold;
+	    if (!all[a][i].valid || !cold->valid) {
+		printf("%*s%8s%8s", (a == 0) ? 7 : 8, "-", "-", "-");
+		continue;
+	    }
+	    printf("%*.0f%8llu%8.0f", (a == 0) ? 7 : 8, 
+		   cold->cycles / cold->hist.n, 
+		   hist_percentile(&cold->hist, 0.99),
+		   cold->start / MIN(cold->hist.n, COLD_START_OPS));
+	    total[a].cycles += cold->cycles;
+	    total[a].start += cold->start;
+	    starts[a] += MIN(cold->hist.n, COLD_START_OPS);
+	    hist_merge(&total[a].hist, &cold->hist);
+	}
+	printf("\n");
+    }
+
+    /* Print the aggregate results */
+    printf("%5s", "Total");
+    for (a = 0; a < num; a++) {
+	if (total[a].hist.n == 0) {
+	    printf("%*s%8s%8s", (a == 0) ? 4 : 8, "-", "-", "-");
+	    avg[a] = DBL_MAX;
+	    continue;
+	}
+	avg[a] = total[a].cycles / total[a].hist.n;
+	printf("%*.0f%8llu%8.0f", (a == 0) ? 4 : 8, avg[a],
+	       hist_percentile(&total[a].hist, 0.99), 
+	       total[a].start / starts[a]);
+    }
+    printf("\n");
+
+    /* Rank the allocators that ran all of the traces */
+    for (a = 0; a < num; a++) {
+	for (b = a; b > 0 && avg[order[b-1]] > avg[a]; b--)
+	    order[b] = order[b-1];
+	order[b] = a;
+    }
+    printf("Ranked by the average:");
+    for (a = 0; a < num && avg[order[a]] < DBL_MAX; a++)
+	printf(" %d. %s", a + 1, names[order[a]]);
+    printf("\n");
+}
+
+/*
+ * printresults_heap - prints the peak and final heap sizes that the mm
+ *     package reached on each trace, how often it grew and shrank, and
+ *     the samples taken in between
+ */
+static void printresults_heap(int n, stats_t *stats) 
+{
+    int i, j;
+
+    printf("%5s%8s%8s%7s%7s  %s\n", 
+	   "trace", "peak", "end", "grows", "trims", "after each tenth");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%11s%8s%7s%7s\n", i, "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%11.0f%8.0f%7.0f%7.0f ", i, stats[i].heap_peak/1024, 
+	       stats[i].heap_end/1024, (double)stats[i].mm.heap_grows, 
+	       (double)stats[i].mm.heap_trims);
+	for (j = 0; j < HEAP_SAMPLES; j++)
+	    printf("%6.0f", stats[i].heap_samples[j]/1024);
+	printf("\n");
+    }
+}
+
+/*
+ * printresults_mm - prints the counters that mm_stats returned after
+ *     each trace: how many fit searches there were and how long they
+ *     took, how blocks were split and coalesced, how many free blocks
+ *     were left and how much of the blocks the requests didn't use
+ */
+static void printresults_mm(int n, stats_t *stats) 
+{
+    mm_stats_t *m;
+    int i;
+
+    printf("%5s%8s%9s%7s%6s%8s%8s%7s%7s%7s%7s%7s\n", 
+	   "trace", "mallocs", "searches", "steps", "miss%", "splits",
+	   "none", "next", "prev", "both", "free", "waste%");
+    for (i=0; i < n; i++) {
+	m = &stats[i].mm;
+	if (!stats[i].valid) {
+	    printf("%2d%11s\n", i, "-");
+	    continue;
+	}
+	printf("%2d%11lu%9lu%7.1f%6.1f%8lu%8lu%7lu%7lu%7lu%7lu%7.1f\n", i,
+	       (unsigned long)m->mallocs, (unsigned long)m->fit_searches,
+	       m->fit_searches ? (double)m->fit_steps/m->fit_searches : 0.0,
+	       m->fit_searches ? 100.0*m->fit_misses/m->fit_searches : 0.0,
+	       (unsigned long)m->splits, (unsigned long)m->coalesces[0],
+	       (unsigned long)m->coalesces[1], (unsigned long)m->coalesces[2],
+	       (unsigned long)m->coalesces[3], (unsigned long)m->free_blocks,
+	       m->block_bytes ? 
+	       100.0*(m->block_bytes - m->malloc_bytes)/m->block_bytes : 0.0);
+    }
+}
+
+/*
+ * write_results - Write the results of the mm package on each trace to
+ *     path, as JSON if its name ends in .json and as CSV otherwise
+ */
+static void write_results(char *path, char **tracefiles, int n, stats_t *stats,
+			  lat_stats_t *lat_stats, double perfindex)
+{
+    FILE *fp;
+    size_t len = strlen(path);
+    char msg[MAXLINE];
+
+    if ((fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in write_results", path);
+	unix_error(msg);
+    }
+    if (len >= 5 && !strcmp(path + len - 5, ".json"))
+	write_results_json(fp, tracefiles, n, stats, lat_stats, perfindex);
+    else
+	write_results_csv(fp, tracefiles, n, stats, lat_stats);
+    if (fclose(fp) != 0) {
+	sprintf(msg, "Could not write %s in write_results", path);
+	unix_error(msg);
+    }
+}
+
+/*
+ * write_results_json - Write one object for the whole run with an array
+ *     of one object per trace. Traces that weren't valid only have their
+ *     name and ops. The events are there if -P counted them, null for
+ *     those the machine can't count, and the latencies if -L timed them.
+ */
+static void write_results_json(FILE *fp, char **tracefiles, int n, 
+			       stats_t *stats, lat_stats_t *lat_stats, 
+			       double perfindex)
+{
+    int i, f, type;
+    char *c;
+    hist_t *hist;
+
+    fprintf(fp, "{\n  \"perfindex\": %.1f,\n  \"errors\": %d,\n", 
+	    perfindex, errors);
+    fprintf(fp, "  \"samples\": %d,\n  \"traces\": [", num_samples);
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "%s\n    {\"trace\": %d, \"file\": \"", i ? "," : "", i);
+	for (c = tracefiles[i]; *c; c++) {
+	    if (*c == '"' || *c == '\\')
+		fputc('\\', fp);
+	    fputc(*c, fp);
+	}
+	fprintf(fp, "\", \"valid\": %s, \"ops\": %.0f", 
+		stats[i].valid ? "true" : "false", stats[i].ops);
+	if (!stats[i].valid) {
+	    fprintf(fp, "}");
+	    continue;
+	}
+	fprintf(fp, ",\n     \"secs\": %.9f, \"secs_mean\": %.9f, "
+		"\"secs_sd\": %.9f, \"kops\": %.1f,\n", stats[i].secs, 
+		stats[i].secs_mean, stats[i].secs_sd, 
+		(stats[i].ops/1e3)/stats[i].secs);
+	fprintf(fp, "     \"util\": %.6f, \"heap_peak\": %.0f, "
+		"\"heap_end\": %.0f,\n     \"mm\": {", stats[i].util, 
+		stats[i].heap_peak, stats[i].heap_end);
+	for (f = 0; f < NUM_MM_FIELDS; f++)
+	    fprintf(fp, "%s\"%s\": %lu", f ? ", " : "", mm_fields[f].name,
+		    (unsigned long)MM_FIELD(&stats[i].mm, f));
+	fprintf(fp, "},\n     \"free\": {\"op\": %.0f, \"live\": %.0f, "
+		"\"blocks\": %.0f, \"free_blocks\": %.0f, \"free_bytes\": %.0f, "
+		"\"largest\": %.0f,\n              \"hist\": {", stats[i].frag.op,
+		stats[i].frag.live, stats[i].frag.blocks, 
+		stats[i].frag.free_blocks, stats[i].frag.free_bytes, 
+		stats[i].frag.largest);
+	for (f = 0; f < FRAG_BUCKETS; f++)
+	    fprintf(fp, "%s\"%s\": %.0f", f ? ", " : "", frag_names[f],
+		    stats[i].frag.hist[f]);
+	fprintf(fp, "}}");
+	if (count_events) {
+	    fprintf(fp, ",\n     \"perf\": {");
+	    for (f = 0; f < PERFCTR_NUM; f++)
+		if (stats[i].perf[f] < 0)
+		    fprintf(fp, "%s\"%s\": null", f ? ", " : "", 
+			    perfctr_names[f]);
+		else
+		    fprintf(fp, "%s\"%s\": %.0f", f ? ", " : "", 
+			    perfctr_names[f], stats[i].perf[f]);
+	    fprintf(fp, "}");
+	}
+	if (lat_stats && lat_stats[i].valid) {
+	    fprintf(fp, ",\n     \"latency\": {");
+	    for (type = ALLOC; type <= CALLOC; type++) {
+		hist = &lat_stats[i].hists[type];
+		fprintf(fp, "%s\"%s\": {\"n\": %.0f", 
+			(type != ALLOC) ? ",\n                 " : "",
+			op_names[type], hist->n);
+		if (hist->n > 0) {
+		    for (f = 0; f < NUM_LAT_FIELDS; f++)
+			fprintf(fp, ", \"%s\": %llu", lat_fields[f].name,
+				hist_percentile(hist, lat_fields[f].p));
+		    fprintf(fp, ", \"max\": %llu", hist->max);
+		}
+		fprintf(fp, "}");
+	    }
+	    fprintf(fp, "}");
+	}
+	if (pressure_bytes > 0 && stats[i].cold.valid) {
+	    hist = &stats[i].cold.hist;
+	    fprintf(fp, ",\n     \"cold\": {\"avg\": %.1f, \"start\": %.1f",
+		    stats[i].cold.cycles / hist->n,
+		    stats[i].cold.start / MIN(hist->n, COLD_START_OPS));
+	    for (f = 0; f < NUM_LAT_FIELDS; f++)
+		fprintf(fp, ", \"%s\": %llu", lat_fields[f].name,
+			hist_percentile(hist, lat_fields[f].p));
+	    fprintf(fp, ", \"max\": %llu}", hist->max);
+	}
+	fprintf(fp, "}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+/*
+ * write_results_csv - Write a header line and one line per trace. The
+ *     fields that a trace doesn't have (it wasn't valid, an event wasn't
+ *     counted, it wasn't timed with -L, it made no requests of some type)
+ *     are left empty.
+ */
+static void write_results_csv(FILE *fp, char **tracefiles, int n, 
+			      stats_t *stats, lat_stats_t *lat_stats)
+{
+    int i, f, type;
+    hist_t *hist;
+
+    fprintf(fp, "trace,file,valid,ops,secs,secs_mean,secs_sd,samples,"
+	    "kops,util,heap_peak,heap_end");
+    for (f = 0; f < NUM_MM_FIELDS; f++)
+	fprintf(fp, ",%s", mm_fields[f].name);
+    fprintf(fp, ",free_op,free_live,free_blocks_now,free_bytes_now,"
+	    "free_largest");
+    for (f = 0; f < FRAG_BUCKETS; f++)
+	fprintf(fp, ",free_%s", frag_names[f]);
+    for (f = 0; f < PERFCTR_NUM; f++)
+	fprintf(fp, ",%s", perfctr_names[f]);
+    for (type = ALLOC; type <= CALLOC; type++) {
+	fprintf(fp, ",%s_n", op_names[type]);
+	for (f = 0; f < NUM_LAT_FIELDS; f++)
+	    fprintf(fp, ",%s_%s", op_names[type], lat_fields[f].name);
+	fprintf(fp, ",%s_max", op_names[type]);
+    }
+    fprintf(fp, ",cold_avg,cold_start");
+    for (f = 0; f < NUM_LAT_FIELDS; f++)
+	fprintf(fp, ",cold_%s", lat_fields[f].name);
+    fprintf(fp, ",cold_max\n");
+
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "%d,", i);
+	write_csv_field(fp, tracefiles[i]);
+	fprintf(fp, ",%d,%.0f", stats[i].valid, stats[i].ops);
+	if (!stats[i].valid) {
+	    for (f = 0; f < 8 + NUM_MM_FIELDS + 5 + FRAG_BUCKETS + PERFCTR_NUM +
+		     5 * (NUM_LAT_FIELDS + 2) + NUM_LAT_FIELDS + 3; f++)
+		fprintf(fp, ",");
+	    fprintf(fp, "\n");
+	    continue;
+	}
+	fprintf(fp, ",%.9f,%.9f,%.9f,%d,%.1f,%.6f,%.0f,%.0f", stats[i].secs,
+		stats[i].secs_mean, stats[i].secs_sd, stats[i].samples,
+		(stats[i].ops/1e3)/stats[i].secs, stats[i].util, 
+		stats[i].heap_peak, stats[i].heap_end);
+	for (f = 0; f < NUM_MM_FIELDS; f++)
+	    fprintf(fp, ",%lu", (unsigned long)MM_FIELD(&stats[i].mm, f));
+	fprintf(fp, ",%.0f,%.0f,%.0f,%.0f,%.0f", stats[i].frag.op, 
+		stats[i].frag.live, stats[i].frag.free_blocks, 
+		stats[i].frag.free_bytes, stats[i].frag.largest);
+	for (f = 0; f < FRAG_BUCKETS; f++)
+	    fprintf(fp, ",%.0f", stats[i].frag.hist[f]);
+	for (f = 0; f < PERFCTR_NUM; f++)
+	    if (count_events && stats[i].perf[f] >= 0)
+		fprintf(fp, ",%.0f", stats[i].perf[f]);
+	    else
+		fprintf(fp, ",");
+	for (type = ALLOC; type <= CALLOC; type++) {
+	    if (!lat_stats || !lat_stats[i].valid) {
+		fprintf(fp, ",,,,,,");
+		continue;
+	    }
+	    hist = &lat_stats[i].hists[type];
+	    fprintf(fp, ",%.0f", hist->n);
+	    if (hist->n == 0) {
+		fprintf(fp, ",,,,,");
+		continue;
+	    }
+	    for (f = 0; f < NUM_LAT_FIELDS; f++)
+		fprintf(fp, ",%llu", hist_percentile(hist, lat_fields[f].p));
+	    fprintf(fp, ",%llu", hist->max);
+	}
+	if (pressure_bytes == 0 || !stats[i].cold.valid) {
+	    for (f = 0; f < NUM_LAT_FIELDS + 3; f++)
+		fprintf(fp, ",");
+	    fprintf(fp, "\n");
+	    continue;
+	}
+	hist = &stats[i].cold.hist;
+	fprintf(fp, ",%.1f,%.1f", stats[i].cold.cycles / hist->n,
+		stats[i].cold.start / MIN(hist->n, COLD_START_OPS));
+	for (f = 0; f < NUM_LAT_FIELDS; f++)
+	    fprintf(fp, ",%llu", hist_percentile(hist, lat_fields[f].p));
+	fprintf(fp, ",%llu\n", hist->max);
+    }
+}
+
+/*
+ * compare_results - Compare the results of the mm package with those in
+ *     a CSV file that an earlier run wrote with -o, matching the traces by
+ *     file name. Prints the change of the mean time and utilization of
+ *     each trace and returns the number of traces that got slower (see
+ *     COMPARE_MIN) or less space efficient, or that are no longer valid.
+ */
+static int compare_results(char *path, char **tracefiles, int n, 
+			   stats_t *stats)
+{
+    FILE *fp;
+    char line[4*MAXLINE], msg[MAXLINE];
+    char *fields[4*MAXLINE/2];
+    int i, j, nfields, file, valid, mean, sd, util;
+    int *found, *base_valid, regressions = 0;
+    double *base_mean, *base_sd, *base_util;
+    double delta, noise, threshold, util_delta;
+    char *verdict;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in compare_results", path);
+	unix_error(msg);
+    }
+    if (fgets(line, sizeof(line), fp) == NULL) {
+	sprintf(msg, "Baseline %s is empty", path);
+	app_error(msg);
+    }
+    nfields = split_csv(line, fields, sizeof(fields) / sizeof(fields[0]));
+    file = find_field(fields, nfields, "file");
+    valid = find_field(fields, nfields, "valid");
+    mean = find_field(fields, nfields, "secs_mean");
+    sd = find_field(fields, nfields, "secs_sd");
+    util = find_field(fields, nfields, "util");
+    if (file < 0 || valid < 0 || mean < 0 || sd < 0 || util < 0) {
+	sprintf(msg, "Baseline %s isn't a CSV file written by mdriver -o", path);
+	app_error(msg);
+    }
+
+    found = (int *)calloc(n, sizeof(int));
+    base_valid = (int *)calloc(n, sizeof(int));
+    base_mean = (double *)calloc(n, sizeof(double));
+    base_sd = (double *)calloc(n, sizeof(double));
+    base_util = (double *)calloc(n, sizeof(double));
+    if (!found || !base_valid || !base_mean || !base_sd || !base_util)
+	unix_error("calloc failed in compare_results");
+
+    /* Pick the baseline lines of the traces that we ran */
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (split_csv(line, fields, nfields) < nfields)
+	    continue;
+	for (j = 0; j < n && strcmp(tracefiles[j], fields[file]); j++)
+	    ;
+	if (j == n)
+	    continue;
+	found[j] = 1;
+	base_valid[j] = atoi(fields[valid]);
+	base_mean[j] = atof(fields[mean]);
+	base_sd[j] = atof(fields[sd]);
+	base_util[j] = atof(fields[util]);
+    }
+    fclose(fp);
+
+    printf("%5s%8s%9s%8s%8s%7s\n", 
+	   "trace", "base ms", "now ms", "delta", "noise", "util");
+    for (i = 0; i < n; i++) {
+	if (!found[i] || !base_valid[i] || !stats[i].valid) {
+	    verdict = !found[i] ? "not in baseline" : 
+		!stats[i].valid ? "not valid" : "not valid in baseline";
+	    printf("%2d%11s%9s%8s%8s%7s  %s\n", 
+		   i, "-", "-", "-", "-", "-", verdict);
+	    if (found[i] && base_valid[i])
+		regressions++;
+	    continue;
+	}
+
+	/* The noise of both means, relative to each of them */
+	delta = stats[i].secs_mean / base_mean[i] - 1;
+	noise = sqrt((base_sd[i] / base_mean[i]) * (base_sd[i] / base_mean[i]) +
+		     (stats[i].secs_sd / stats[i].secs_mean) * 
+		     (stats[i].secs_sd / stats[i].secs_mean));
+	threshold = MAX(COMPARE_MIN, COMPARE_SIGMAS * noise);
+	util_delta = stats[i].util - base_util[i];
+	if (fabs(util_delta) < 1e-6) /* the baseline has 6 digits */
+	    util_delta = 0;
+
+	if (delta > threshold && util_delta < -COMPARE_UTIL)
+	    verdict = "slower, less util";
+	else if (delta > threshold)
+	    verdict = "slower";
+	else if (util_delta < -COMPARE_UTIL)
+	    verdict = "less util";
+	else if (delta < -threshold)
+	    verdict = "faster";
+	else
+	    verdict = "";
+	if (delta > threshold || util_delta < -COMPARE_UTIL)
+	    regressions++;
+
+	printf("%2d%11.3f%9.3f%+7.1f%%%7.1f%%%+7.1f  %s\n", i, 
+	       base_mean[i]*1e3, stats[i].secs_mean*1e3, delta*100, 
+	       noise*100, util_delta*100, verdict);
+    }
+
+    free(found);
+    free(base_valid);
+    free(base_mean);
+    free(base_sd);
+    free(base_util);
+    return regressions;
+}
+
+/*
+ * write_csv_field - Write field to a CSV file, in double quotes if it 
+ *     has a comma or a quote, with the quotes in it doubled
+ */
+static void write_csv_field(FILE *fp, char *field)
+{
+    char *c;
+
+    if (strpbrk(field, ",\"") == NULL) {
+	fputs(field, fp);
+	return;
+    }
+    fputc('"', fp);
+    for (c = field; *c; c++) {
+	if (*c == '"')
+	    fputc('"', fp);
+	fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * split_csv - Split a line of a CSV file in place into at most max
+ *     fields and return how many there are. A field in double quotes
+ *     may have commas in it, and "" stands for a quote.
+ */
+static int split_csv(char *line, char **fields, int max)
+{
+    int n = 0, quoted;
+    char *to;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    while (n < max) {
+	fields[n++] = to = line;
+	quoted = (*line == '"');
+	line += quoted;
+	for (; *line != '\0'; line++) {
+	    if (quoted && *line == '"') {
+		if (line[1] != '"') {
+		    quoted = 0;     /* the closing quote */
+		    continue;
+		}
+		line++;             /* "" is one quote */
+	    }
+	    else if (!quoted && *line == ',')
+		break;
+	    *to++ = *line;
+	}
+	if (*line == '\0') {
+	    *to = '\0';
+	    break;
+	}
+	*to = '\0';
+	line++;
+    }
+    return n;
+}
+
+/*
+ * find_field - Return the index of the field called name, or -1
+ */
+static int find_field(char **fields, int n, char *name)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+	if (!strcmp(fields[i], name))
+	    return i;
+    return -1;
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -999,19 +3745,153 @@ void malloc_error(int tracenum, int opnum, char *msg)
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * parse_policy - Select the mm placement policy named by a -p argument:
+ *     first, next, good[:N] or best
+ */
+static void parse_policy(char *arg)
+{
+    int nfit = 0;
+
+    if (!strcmp(arg, "first"))
+	mm_set_policy(MM_FIRST_FIT, 0);
+    else if (!strcmp(arg, "next"))
+	mm_set_policy(MM_NEXT_FIT, 0);
+    else if (!strcmp(arg, "best"))
+	mm_set_policy(MM_BEST_FIT, 0);
+    else if (!strncmp(arg, "good", 4) && 
+	     (arg[4] == '\0' || sscanf(arg + 4, ":%d", &nfit) == 1))
+	mm_set_policy(MM_GOOD_FIT, nfit);
+    else {
+	fprintf(stderr, "Unknown placement policy: %s\n", arg);
+	usage();
+	exit(1);
+    }
+}
+
+/*
+ * parse_trim - Set the trim threshold and pad of the mm package from a
+ *     -T argument: <threshold>[:<pad>] in bytes, 0 turns trimming off
+ */
+static void parse_trim(char *arg)
+{
+    long threshold, pad = 0;
+    char *end;
+
+    threshold = strtol(arg, &end, 0);
+    if (*end == ':')
+	pad = strtol(end + 1, &end, 0);
+    if (*end != '\0' || threshold < 0 || pad < 0) {
+	fprintf(stderr, "Bad trim setting: %s\n", arg);
+	usage();
+	exit(1);
+    }
+    mm_set_trim(threshold, (strchr(arg, ':') != NULL) ? pad : threshold / 4);
+}
+
+/*
+ * parse_backend - Set the memlib backend from a -m argument
+ */
+static void parse_backend(char *arg)
+{
+    if (!strcmp(arg, "malloc"))
+	backend = MEM_BACKEND_MALLOC;
+    else if (!strcmp(arg, "mmap"))
+	backend = MEM_BACKEND_MMAP;
+    else if (!strcmp(arg, "thp"))
+	backend = MEM_BACKEND_THP;
+    else if (!strcmp(arg, "hugetlb"))
+	backend = MEM_BACKEND_HUGETLB;
+    else {
+	fprintf(stderr, "Unknown memory backend: %s\n", arg);
+	usage();
+	exit(1);
+    }
+    mem_set_backend(backend);
+}
+
+/*
+ * parse_pressure - Set the cache pressure from a -X argument: the size
+ *     of the buffer to thrash, and optionally after how many requests
+ */
+static void parse_pressure(char *arg)
+{
+    char size[MAXLINE], *colon, *end;
+
+    strncpy(size, arg, MAXLINE - 1);
+    size[MAXLINE - 1] = '\0';
+    if ((colon = strchr(size, ':')) != NULL) {
+	*colon = '\0';
+	pressure_every = strtol(colon + 1, &end, 0);
+	if (*end != '\0' || pressure_every < 1) {
+	    fprintf(stderr, "Bad cache pressure setting: %s\n", arg);
+	    usage();
+	    exit(1);
+	}
+    }
+    if ((pressure_bytes = parse_size(size)) < CACHE_LINE) {
+	fprintf(stderr, "The cache pressure must be at least %d bytes\n", 
+		CACHE_LINE);
+	usage();
+	exit(1);
+    }
+}
+
+/*
+ * parse_size - Read a size in bytes with an optional K, M or G suffix
+ */
+static size_t parse_size(char *arg)
+{
+    unsigned long size;
+    char *end;
+
+    size = strtoul(arg, &end, 0);
+    switch (*end) {
+    case 'K': case 'k': size <<= 10; end++; break;
+    case 'M': case 'm': size <<= 20; end++; break;
+    case 'G': case 'g': size <<= 30; end++; break;
+    }
+    if (*end != '\0' || end == arg) {
+	fprintf(stderr, "Bad size: %s\n", arg);
+	usage();
+	exit(1);
+    }
+    return (size_t)size;
+}
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValcLbdP] [-f <file>] [-t <dir>] [-p <policy>] [-n <n>] [-T <trim>]\n");
+    fprintf(stderr, "               [-m <backend>] [-M <size>] [-H <size>] [-s <n>] [-o <file>] [-C <file>]\n");
+    fprintf(stderr, "               [-D <file>] [-j <n>] [-X <size>[:<n>]] [-R <lib>]...\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-b         Also replay the traces with batch requests.\n");
+    fprintf(stderr, "\t-c         With -n, each thread replays a copy of the trace.\n");
+    fprintf(stderr, "\t-C <file>  Compare with the results in CSV <file>, exit 1 if slower.\n");
+    fprintf(stderr, "\t-d         Defer coalescing of small freed blocks.\n");
+    fprintf(stderr, "\t-D <file>  Write the blocks of the mm heap after each tenth of a trace to <file>.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <size>  Largest size of each heap, e.g. 256M (default 20M).\n");
+    fprintf(stderr, "\t-j <n>     Check the traces in <n> worker processes, then time them one by one.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print latency percentiles of the mm requests.\n");
+    fprintf(stderr, "\t-m <mem>   Heap storage: malloc, mmap, thp, hugetlb.\n");
+    fprintf(stderr, "\t-M <size>  Map requests of <size> bytes or more (default 256K, 0 never).\n");
+    fprintf(stderr, "\t-n <n>     Also replay the traces split over <n> threads.\n");
+    fprintf(stderr, "\t-o <file>  Write the results to <file>, JSON if it ends in .json, else CSV.\n");
+    fprintf(stderr, "\t-p <pol>   Placement policy: first, next, good[:N], best.\n");
+    fprintf(stderr, "\t-P         Count cache, TLB and branch misses of the mm package.\n");
+    fprintf(stderr, "\t-R <lib>   Run the malloc of shared library <lib> as well, e.g. libjemalloc.so.2.\n");
+    fprintf(stderr, "\t-s <n>     Time each trace <n> times (default 1, 5 with -o or -C).\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <t[:p]> Trim the heap down to p bytes when t bytes are free at its end.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-X <s[:n]> Also time the requests with s bytes thrashed after every n (default %d).\n", PRESSURE_EVERY);
 }
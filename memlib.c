@@ -2,22 +2,211 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            The memory system consists of up to MEM_MAX_REGIONS regions,
+ *            each of them a heap of MAX_HEAP bytes (or what mem_set_max_heap
+ *            asked for) with its own brk pointer. Region 0 always exists
+ *            and is the heap that mem_sbrk and the other mem_heap
+ *            functions work on.
+ *
+ *            By default a region is a block of libc malloc. The mmap
+ *            backends reserve the region's address range with PROT_NONE
+ *            and commit it in MEM_COMMIT_CHUNK steps as brk moves up, so
+ *            only the part of the heap in use costs memory. MEM_BACKEND_THP
+ *            asks for transparent huge pages with madvise, and
+ *            MEM_BACKEND_HUGETLB maps the range from the huge page pool.
+ *
+ *            Besides the heaps, mem_map hands out page aligned mappings of
+ *            their own, for blocks too large to carve from a heap. They
+ *            count towards mem_heapsize and mem_heappeak, and mem_reset_brk
+ *            unmaps the ones still live.
  */
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <string.h>
+#include <stdint.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* The mmap backends make brk accessible in steps of this many bytes */
+#define MEM_COMMIT_CHUNK (1<<16)
+
+/* Size of a huge page, MEM_BACKEND_THP and MEM_BACKEND_HUGETLB align to it */
+#define MEM_HUGEPAGE_SIZE (1<<21)
+
+/* Extent of one simulated heap region */
+typedef struct {
+    char *start_brk;  /* points to first byte of heap */
+    char *brk;        /* points to last byte of heap */
+    char *peak_brk;   /* highest brk since the last reset */
+    char *clean_brk;  /* memory above was never part of a heap, it is zero */
+    char *max_addr;   /* largest legal heap address */ 
+    mem_backend_t backend; /* how the storage of the region was obtained */
+    char *map_start;  /* start of the mapping of the mmap backends, or */
+    size_t map_size;  /* of the malloc block, and its size */
+    char *commit_brk; /* end of the part that is readable and writable */
+    size_t commit_chunk; /* commit_brk moves in steps of this many bytes */
+} region_t;
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static region_t regions[MEM_MAX_REGIONS];
+static int num_regions = 0;
+static mem_backend_t mem_backend = MEM_BACKEND_MALLOC; /* for new regions */
+static size_t mem_max_heap = MAX_HEAP; 
+
+/* 
+ * Live mappings of mem_map, threads may map and unmap concurrently. They
+ * are kept in an open addressing table by their start, so mem_unmap and 
+ * mem_remap find theirs without looking at the others.
+ */
+typedef struct {
+    char *start;      /* NULL if the slot is empty */
+    size_t size;
+} mapping_t;
+
+#define MAPS_MIN 64   /* initial size of the table */
+
+static mapping_t *maps = NULL;
+static size_t num_maps = 0, maps_size = 0;
+static size_t mapped_bytes = 0;  /* bytes of all live mappings */
+static size_t peak_bytes = 0;    /* largest heap of region 0 plus mappings */
+static pthread_mutex_t maps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void update_peak(void);
+static size_t map_slot(char *p);
+static int find_map(char *p);
+static int map_insert(char *p, size_t size);
+static void map_remove(size_t i);
+static int maps_grow(void);
+static int region_map(region_t *r, size_t size);
+static int region_commit(region_t *r, char *end);
+static void region_decommit(region_t *r, char *end);
+
+/*
+ * region_init - allocate the storage that models the VM of region r
+ */
+static int region_init(region_t *r)
+{
+    r->backend = mem_backend;
+    if (r->backend == MEM_BACKEND_MALLOC) {
+	/* 
+	 * calloc, so that storage the heap never used reads as zero. The
+	 * start is aligned like that of the huge page backends, otherwise
+	 * the padding of aligned blocks would depend on where libc put it.
+	 */
+	r->map_size = mem_max_heap + MEM_HUGEPAGE_SIZE;
+	if ((r->map_start = (char *)calloc(1, r->map_size)) == NULL)
+	    return -1;
+	r->start_brk = (char *)(((size_t)r->map_start + MEM_HUGEPAGE_SIZE - 1) & 
+				~(size_t)(MEM_HUGEPAGE_SIZE - 1));
+    }
+    else if (region_map(r, mem_max_heap) < 0)
+	return -1;
+    r->max_addr = r->start_brk + mem_max_heap;  /* max legal heap address */
+    r->brk = r->start_brk;                      /* heap is empty initially */
+    r->peak_brk = r->start_brk;
+    r->clean_brk = r->start_brk;
+    return 0;
+}
+
+/*
+ * region_map - reserve size bytes of address space for region r without
+ *    committing any of it. The huge page backends align the start of
+ *    the heap to a huge page. If the huge page pool can't hold the
+ *    reservation, MEM_BACKEND_HUGETLB falls back to MEM_BACKEND_THP.
+ */
+static int region_map(region_t *r, size_t size)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    size_t align = (r->backend == MEM_BACKEND_MMAP) ? 
+	mem_pagesize() : MEM_HUGEPAGE_SIZE;
+    char *p = MAP_FAILED;
+
+    r->commit_chunk = MEM_COMMIT_CHUNK;
+    r->map_size = (size + align - 1) / align * align;
+#ifdef MAP_HUGETLB
+    if (r->backend == MEM_BACKEND_HUGETLB) {
+	/* Without MAP_NORESERVE an empty pool fails here, not with SIGBUS later */
+	p = mmap(NULL, r->map_size, PROT_NONE, 
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p == MAP_FAILED) {
+	    fprintf(stderr, "mem_init: no huge pages for MAP_HUGETLB, "
+		    "using transparent huge pages instead\n");
+	    r->backend = MEM_BACKEND_THP;
+	}
+	else
+	    r->commit_chunk = MEM_HUGEPAGE_SIZE;
+    }
+#else
+    if (r->backend == MEM_BACKEND_HUGETLB)
+	r->backend = MEM_BACKEND_THP;
+#endif
+    if (p == MAP_FAILED) {
+	/* Reserve one huge page more, so the start can be aligned */
+	r->map_size += align - mem_pagesize();
+	if ((p = mmap(NULL, r->map_size, PROT_NONE, flags, -1, 0)) == MAP_FAILED)
+	    return -1;
+    }
+    r->map_start = p;
+    r->start_brk = (char *)(((size_t)p + align - 1) & ~(align - 1));
+    r->commit_brk = r->start_brk;
+#ifdef MADV_HUGEPAGE
+    if (r->backend == MEM_BACKEND_THP)
+	madvise(r->map_start, r->map_size, MADV_HUGEPAGE);
+#endif
+    return 0;
+}
+
+/*
+ * region_commit - make the heap of region r accessible up to end
+ */
+static int region_commit(region_t *r, char *end)
+{
+    char *new_commit;
+
+    if (r->backend == MEM_BACKEND_MALLOC || end <= r->commit_brk)
+	return 0;
+    new_commit = r->start_brk + ((end - r->start_brk) + r->commit_chunk - 1) / 
+	r->commit_chunk * r->commit_chunk;
+    if (new_commit > r->map_start + r->map_size)
+	new_commit = r->map_start + r->map_size;
+    if (mprotect(r->commit_brk, new_commit - r->commit_brk, 
+		 PROT_READ | PROT_WRITE) < 0)
+	return -1;
+    r->commit_brk = new_commit;
+    return 0;
+}
+
+/*
+ * region_decommit - tell the system that the whole commit chunks of
+ *    region r above end are unused. With MADV_FREE it takes the pages
+ *    only when it runs short of memory, so a heap that grows back soon
+ *    doesn't fault them in again. They stay committed. Pages of the
+ *    huge page pool stay with the region anyway.
+ */
+static void region_decommit(region_t *r, char *end)
+{
+    char *free_start;
+
+    if (r->backend == MEM_BACKEND_MALLOC || r->backend == MEM_BACKEND_HUGETLB)
+	return;
+    free_start = r->start_brk + ((end - r->start_brk) + r->commit_chunk - 1) / 
+	r->commit_chunk * r->commit_chunk;
+    if (free_start >= r->commit_brk)
+	return;
+#ifdef MADV_FREE
+    madvise(free_start, r->commit_brk - free_start, MADV_FREE);
+#else
+    madvise(free_start, r->commit_brk - free_start, MADV_DONTNEED);
+#endif
+}
 
 /* 
  * mem_init - initialize the memory system model
@@ -25,13 +214,11 @@ static char *mem_max_addr;   /* largest legal heap address */
 void mem_init(void)
 {
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+    if (region_init(&regions[0]) < 0) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    num_regions = 1;
 }
 
 /* 
@@ -39,7 +226,33 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    int i;
+
+    for (i = 0; i < num_regions; i++) {
+	if (regions[i].backend == MEM_BACKEND_MALLOC)
+	    free(regions[i].map_start);
+	else
+	    munmap(regions[i].map_start, regions[i].map_size);
+    }
+    num_regions = 0;
+}
+
+/*
+ * mem_set_backend - choose how the regions created from now on get
+ *    their storage, call it before mem_init to include region 0
+ */
+void mem_set_backend(mem_backend_t backend)
+{
+    mem_backend = backend;
+}
+
+/*
+ * mem_set_max_heap - set the size of the regions created from now on,
+ *    which is the ceiling of each heap. The default is MAX_HEAP.
+ */
+void mem_set_max_heap(size_t size)
+{
+    mem_max_heap = size;
 }
 
 /*
@@ -47,25 +260,38 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    size_t i;
+
+    mem_region_reset_brk(0);
+    pthread_mutex_lock(&maps_lock);
+    for (i = 0; i < maps_size; i++)
+	if (maps[i].start != NULL) {
+	    munmap(maps[i].start, maps[i].size);
+	    maps[i].start = NULL;
+	}
+    num_maps = 0;
+    mapped_bytes = 0;
+    peak_bytes = 0;
+    pthread_mutex_unlock(&maps_lock);
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
  *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    this model, the heap can only be shrunk with mem_trim.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_region_sbrk(0, incr);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
+/*
+ * mem_trim - shrink the heap by decr bytes, the bytes at the top of
+ *    the heap are given back. Returns 0, or -1 if the heap is smaller.
+ */
+int mem_trim(int decr)
+{
+    return mem_region_trim(0, decr);
 }
 
 /*
@@ -73,7 +299,7 @@ void *mem_sbrk(int incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_region_lo(0);
 }
 
 /* 
@@ -81,15 +307,293 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_region_hi(0);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, with the mappings
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_region_heapsize(0) + mapped_bytes;
+}
+
+/*
+ * mem_heappeak() - returns the largest heap size since the last reset,
+ *     with the mappings
+ */
+size_t mem_heappeak()
+{
+    /* Without mappings, mem_region_sbrk leaves the peak to peak_brk */
+    update_peak();
+    return (peak_bytes > mem_region_heappeak(0)) ? 
+	peak_bytes : mem_region_heappeak(0);
+}
+
+/*
+ * update_peak - account for the current size of the heap and the mappings
+ */
+static void update_peak(void)
+{
+    pthread_mutex_lock(&maps_lock);
+    if (mem_region_heapsize(0) + mapped_bytes > peak_bytes)
+	peak_bytes = mem_region_heapsize(0) + mapped_bytes;
+    pthread_mutex_unlock(&maps_lock);
+}
+
+/*
+ * mem_map - map size bytes, rounded up to whole pages, outside the heaps.
+ *    Returns the page aligned start of the mapping, or (void *)-1.
+ */
+void *mem_map(size_t size)
+{
+    char *p;
+
+    size = (size + mem_pagesize() - 1) / mem_pagesize() * mem_pagesize();
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    pthread_mutex_lock(&maps_lock);
+    if (map_insert(p, size) < 0) {
+	pthread_mutex_unlock(&maps_lock);
+	munmap(p, size);
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    mapped_bytes += size;
+    pthread_mutex_unlock(&maps_lock);
+    update_peak();
+    return p;
+}
+
+/*
+ * map_slot - slot of the mapping that starts at p in the table, or the
+ *    empty slot where it would go. The caller holds maps_lock and the 
+ *    table isn't empty. Mappings are page aligned, the low bits of p 
+ *    don't tell them apart.
+ */
+static size_t map_slot(char *p)
+{
+    size_t i = ((uintptr_t)p >> 12) * 0x9E3779B97F4A7C15ULL & (maps_size - 1);
+
+    while (maps[i].start != NULL && maps[i].start != p)
+	i = (i + 1) & (maps_size - 1);
+    return i;
+}
+
+/*
+ * find_map - slot of the mapping that starts at p, the caller holds
+ *    maps_lock. Returns -1 if there is none.
+ */
+static int find_map(char *p)
+{
+    size_t i;
+
+    if (maps_size == 0 || maps[i = map_slot(p)].start == NULL)
+	return -1;
+    return (int)i;
+}
+
+/*
+ * map_insert - add the mapping of size bytes at p to the table, the
+ *    caller holds maps_lock. Returns 0, or -1 if the table can't grow.
+ */
+static int map_insert(char *p, size_t size)
+{
+    size_t i;
+
+    if (2 * (num_maps + 1) > maps_size && maps_grow() < 0)
+	return -1;
+    i = map_slot(p);
+    maps[i].start = p;
+    maps[i].size = size;
+    num_maps++;
+    return 0;
+}
+
+/*
+ * map_remove - empty slot i of the table, the entries behind it move up
+ *    to close the gap. The caller holds maps_lock.
+ */
+static void map_remove(size_t i)
+{
+    size_t j, home;
+
+    for (j = (i + 1) & (maps_size - 1); maps[j].start != NULL;
+	 j = (j + 1) & (maps_size - 1)) {
+	home = ((uintptr_t)maps[j].start >> 12) * 0x9E3779B97F4A7C15ULL &
+	    (maps_size - 1);
+	if (((j - home) & (maps_size - 1)) >= ((j - i) & (maps_size - 1))) {
+	    maps[i] = maps[j];        /* j may move back to the gap at i */
+	    i = j;
+	}
+    }
+    maps[i].start = NULL;
+    num_maps--;
+}
+
+/*
+ * maps_grow - double the table of mappings. It is mapped, not allocated
+ *    with malloc: the allocator may be the process malloc.
+ */
+static int maps_grow(void)
+{
+    mapping_t *old = maps;
+    size_t old_size = maps_size, i;
+
+    maps_size = (old_size == 0) ? MAPS_MIN : 2 * old_size;
+    maps = mmap(NULL, maps_size * sizeof(mapping_t), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (maps == MAP_FAILED) {
+	maps = old;
+	maps_size = old_size;
+	return -1;
+    }
+    num_maps = 0;
+    for (i = 0; i < old_size; i++)
+	if (old[i].start != NULL)
+	    map_insert(old[i].start, old[i].size);
+    if (old != NULL)
+	munmap(old, old_size * sizeof(mapping_t));
+    return 0;
+}
+
+/*
+ * mem_unmap - give the mapping that starts at p back to the system.
+ *    Returns 0, or -1 if p is not the start of a mapping.
+ */
+int mem_unmap(void *p)
+{
+    int i;
+
+    pthread_mutex_lock(&maps_lock);
+    if ((i = find_map(p)) < 0) {
+	pthread_mutex_unlock(&maps_lock);
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_unmap of %p failed. Not a mapping...\n", p);
+	return -1;
+    }
+    munmap(maps[i].start, maps[i].size);
+    mapped_bytes -= maps[i].size;
+    map_remove(i);
+    pthread_mutex_unlock(&maps_lock);
+    return 0;
+}
+
+/*
+ * mem_remap - resize the mapping that starts at p to size bytes, rounded
+ *    up to whole pages. The kernel moves the pages instead of copying
+ *    them if the mapping can't grow where it is. Returns its new start,
+ *    or (void *)-1 and the old mapping stays.
+ */
+void *mem_remap(void *p, size_t size)
+{
+    char *newp;
+    int i;
+
+    size = (size + mem_pagesize() - 1) / mem_pagesize() * mem_pagesize();
+    pthread_mutex_lock(&maps_lock);
+    if ((i = find_map(p)) < 0) {
+	pthread_mutex_unlock(&maps_lock);
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_remap of %p failed. Not a mapping...\n", p);
+	return (void *)-1;
+    }
+#ifdef MREMAP_MAYMOVE
+    newp = mremap(maps[i].start, maps[i].size, size, MREMAP_MAYMOVE);
+#else
+    newp = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (newp != MAP_FAILED) {
+	memcpy(newp, maps[i].start, (size < maps[i].size) ? size : maps[i].size);
+	munmap(maps[i].start, maps[i].size);
+    }
+#endif
+    if (newp == MAP_FAILED) {
+	pthread_mutex_unlock(&maps_lock);
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_remap failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    mapped_bytes += size - maps[i].size;
+    map_remove(i);
+    map_insert(newp, size);   /* can't fail, the slot of p is free again */
+    pthread_mutex_unlock(&maps_lock);
+    update_peak();
+    return newp;
+}
+
+/*
+ * mem_contains - returns 1 if p lies in the extent of a region or in the
+ *    first page of a mapping, that is if the memory system handed it out
+ *    as the start of a block. Pointers of libc come here on every free,
+ *    so nothing is searched: mm puts the payload of a mapped block in
+ *    the first page of its mapping.
+ */
+int mem_contains(void *p)
+{
+    char *page = (char *)((uintptr_t)p & ~(uintptr_t)(mem_pagesize() - 1));
+    int i, found;
+
+    for (i = 0; i < num_regions; i++)
+	if ((char *)p >= regions[i].start_brk && (char *)p < regions[i].max_addr)
+	    return 1;
+    pthread_mutex_lock(&maps_lock);
+    found = (find_map(page) >= 0);
+    pthread_mutex_unlock(&maps_lock);
+    return found;
+}
+
+/*
+ * mem_is_mapped - returns 1 if the bytes from lo to hi lie within one
+ *    mapping of mem_map. Blocks start in the first page of their mapping,
+ *    so that one is looked up first, any other takes a search.
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    char *page = (char *)((uintptr_t)lo & ~(uintptr_t)(mem_pagesize() - 1));
+    size_t j;
+    int i, found = 0;
+
+    pthread_mutex_lock(&maps_lock);
+    if ((i = find_map(page)) >= 0)
+	found = ((char *)hi < maps[i].start + maps[i].size);
+    else
+	for (j = 0; j < maps_size && !found; j++)
+	    found = (maps[j].start != NULL && (char *)lo >= maps[j].start && 
+		     (char *)hi < maps[j].start + maps[j].size);
+    pthread_mutex_unlock(&maps_lock);
+    return found;
+}
+
+/*
+ * mem_fork_prepare - take the lock of the mappings before a fork, so
+ *    no other thread holds it while the process is copied
+ */
+void mem_fork_prepare(void)
+{
+    pthread_mutex_lock(&maps_lock);
+}
+
+/*
+ * mem_fork_parent - release the lock again in the parent after a fork
+ */
+void mem_fork_parent(void)
+{
+    pthread_mutex_unlock(&maps_lock);
+}
+
+/*
+ * mem_fork_child - the child has only the thread that forked, start it
+ *    with an unlocked lock
+ */
+void mem_fork_child(void)
+{
+    pthread_mutex_init(&maps_lock, NULL);
 }
 
 /*
@@ -99,3 +603,122 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_region_create - add a new, empty heap region and return its id,
+ *    or -1 if there are no regions left. Callers that create regions
+ *    from several threads have to serialize the calls.
+ */
+int mem_region_create(void)
+{
+    if (num_regions == MEM_MAX_REGIONS || 
+	region_init(&regions[num_regions]) < 0) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_region_create failed. Ran out of memory...\n");
+	return -1;
+    }
+    return num_regions++;
+}
+
+/*
+ * mem_region_sbrk - mem_sbrk for the heap of region id
+ */
+void *mem_region_sbrk(int id, int incr)
+{
+    region_t *r = &regions[id];
+    char *old_brk = r->brk;
+
+    if ( (incr < 0) || (incr > r->max_addr - r->brk) ||
+	 region_commit(r, r->brk + incr) < 0) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    r->brk += incr;
+    if (r->brk > r->peak_brk)
+	r->peak_brk = r->brk;
+    if (r->brk > r->clean_brk)
+	r->clean_brk = r->brk;
+    if (id == 0 && num_maps != 0)
+	update_peak();
+    return (void *)old_brk;
+}
+
+/*
+ * mem_region_trim - mem_trim for the heap of region id
+ */
+int mem_region_trim(int id, int decr)
+{
+    region_t *r = &regions[id];
+
+    if ( (decr < 0) || ((r->brk - decr) < r->start_brk)) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_trim failed. The heap is smaller...\n");
+	return -1;
+    }
+    r->brk -= decr;
+    region_decommit(r, r->brk);
+    return 0;
+}
+
+/*
+ * mem_region_reset_brk - make the heap of region id empty again, its
+ *    pages stay committed for the next heap, with what it wrote to them
+ */
+void mem_region_reset_brk(int id)
+{
+    regions[id].brk = regions[id].start_brk;
+    regions[id].peak_brk = regions[id].start_brk;
+}
+
+/*
+ * mem_region_lo - return address of the first heap byte of region id
+ */
+void *mem_region_lo(int id)
+{
+    return (void *)regions[id].start_brk;
+}
+
+/*
+ * mem_region_hi - return address of the last heap byte of region id
+ */
+void *mem_region_hi(int id)
+{
+    return (void *)(regions[id].brk - 1);
+}
+
+/*
+ * mem_region_max - return the address just past the largest heap
+ *    region id can ever grow to
+ */
+void *mem_region_max(int id)
+{
+    return (void *)regions[id].max_addr;
+}
+
+/*
+ * mem_region_clean - return the lowest address of region id that no heap
+ *    has reached yet. The storage from there to the maximum still reads
+ *    as zero, trimmed and reset heaps leave their bytes below it.
+ */
+void *mem_region_clean(int id)
+{
+    return (void *)regions[id].clean_brk;
+}
+
+/*
+ * mem_region_heapsize - returns the heap size of region id in bytes
+ */
+size_t mem_region_heapsize(int id)
+{
+    return (size_t)(regions[id].brk - regions[id].start_brk);
+}
+
+/*
+ * mem_region_heappeak - returns the largest heap size of region id 
+ *    since its last reset
+ */
+size_t mem_region_heappeak(int id)
+{
+    return (size_t)(regions[id].peak_brk - regions[id].start_brk);
+}
@@ -1,11 +1,68 @@
 #include <unistd.h>
 
+/*
+ * Where the storage of a heap region comes from: a block of libc
+ * malloc, or an address range reserved with mmap whose pages are
+ * committed as the heap grows, optionally backed by transparent huge
+ * pages or by the MAP_HUGETLB pool.
+ */
+typedef enum {
+    MEM_BACKEND_MALLOC,
+    MEM_BACKEND_MMAP,
+    MEM_BACKEND_THP,
+    MEM_BACKEND_HUGETLB
+} mem_backend_t;
+
+void mem_set_backend(mem_backend_t backend);
+void mem_set_max_heap(size_t size);
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
+int mem_trim(int decr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_heappeak(void);
 size_t mem_pagesize(void);
 
+/*
+ * Mappings outside the heaps, for blocks too large for them. mem_map
+ * returns a page aligned mapping, mem_remap resizes one, possibly at
+ * another address, and mem_unmap gives it back. All three are thread
+ * safe. mem_is_mapped tells whether a range lies in a mapping, and
+ * mem_contains whether a pointer lies in a region or in the first page
+ * of a mapping, where the blocks of mapped memory start.
+ */
+void *mem_map(size_t size);
+void *mem_remap(void *p, size_t size);
+int mem_unmap(void *p);
+int mem_is_mapped(void *lo, void *hi);
+int mem_contains(void *p);
+
+/*
+ * Hooks for pthread_atfork, so a child of a multithreaded process doesn't
+ * inherit the lock of the mappings held by some other thread.
+ */
+void mem_fork_prepare(void);
+void mem_fork_parent(void);
+void mem_fork_child(void);
+
+/*
+ * Heap regions. Every region models a heap of its own with a separate
+ * brk pointer. Region 0 is the heap of mem_sbrk and friends above,
+ * mem_region_create adds a new one and returns its id (or -1).
+ */
+#define MEM_MAX_REGIONS 16
+
+int mem_region_create(void);
+void *mem_region_sbrk(int region, int incr);
+int mem_region_trim(int region, int decr);
+void mem_region_reset_brk(int region);
+void *mem_region_lo(int region);
+void *mem_region_hi(int region);
+void *mem_region_max(int region);
+void *mem_region_clean(int region);
+size_t mem_region_heapsize(int region);
+size_t mem_region_heappeak(int region);
+
@@ -2,20 +2,62 @@
  *
  *  DESCRIPTION:
  *
- *  Our allocator uses two lists to store blocks. The global variable heap_listp points to the beginning of the heap.
- *  The global variable free_listp points to the beginning of the freelist which is used to store all the free blocks of the heap.
- *  We initialize both lists by calling mm_init. This method creates a prologue block which consists of header and footer and an epilogue block
- *  which consists of only a header. The free_lisp is set to NULL since there aren't any free blocks yet.
+ *  Our allocator uses segregated free lists to store blocks. The global variable heap_listp points to the beginning of the heap.
+ *  The global array seg_lists holds the heads of NUM_CLASSES free lists, one per power-of-two size class: class i stores the free
+ *  blocks whose size lies in [2^(i+4), 2^(i+5)). The bitmap seg_mask has bit i set whenever list i is non-empty, so the allocator
+ *  can skip empty classes without touching them. Free blocks of TREE_MIN bytes or more are kept in a splay tree instead, ordered
+ *  by size and then by address. The two links of a free block serve as its children, so a large request finds the smallest block
+ *  that fits (at the lowest address among equal sizes) in O(log n) amortized steps, whatever the placement policy.
+ *  We initialize the lists by calling mm_init. This method creates a prologue block which consists of header and footer and an epilogue block
+ *  which consists of only a header. All the free lists are set to NULL since there aren't any free blocks yet.
  *
- *  When mm_malloc is called the allocator searches for a fitting block in the freelist using the first-fit algorithm (find_fit). If a fitting block
- *  is found the bytes are placed (place) into the block. If the found block can store more than the requested number of bytes and there are still enough
- *  bytes left to store another block of minimum 16 bytes, the found block gets split into two and the free one is added back to the freelist.
+ *  When mm_malloc is called the allocator searches for a fitting block (find_fit). It first walks the class of the request,
+ *  since that class may hold blocks that are too small. If there is no fit it moves on to the next non-empty larger class,
+ *  where every block is big enough. How a block is picked inside a class depends on the placement policy chosen with mm_set_policy:
+ *  first fit, next fit (each class keeps a roving pointer where the last search stopped), good fit (the smallest of the first
+ *  fit_limit candidates) or best fit (the smallest candidate of the class). If a fitting block is found the bytes are placed (place) into the block.
+ *  If the found block can store more than the requested number of bytes and there are still enough bytes left to store another block
+ *  of MINIMUM bytes, the found block gets split into two and the free one is added back to the list of its class.
  *
  *  In case that a fitting block doesn't exist the heap needs to be extended (extend_heap). extend_heap calculates the number of bytes that are needed
- *  and makes sure to align them.
+ *  and makes sure to align them. grow_size picks them: a free block at the end of the heap counts towards the request, and the heap grows
+ *  by at least a growth step that doubles while extensions get used up quickly and shrinks back to CHUNKSIZE when they last long.
+ *  mm_stats counts the extensions and trims.
+ *
+ *  Only free blocks have a footer. Allocated blocks consist of a header and the payload, instead every header stores in bit 1
+ *  whether the previous block is allocated (PREV_ALLOC). coalesce reads the footer of the previous block only if that bit is clear.
  *
  *  The mm_free method frees a block and calls coalesce to check if the freed block is next to another free block(s). If so, the method coalesces them and
- *  modifies the heap and the freelist.
+ *  modifies the heap and the free lists.
+ *
+ *  mm_realloc resizes blocks in place whenever it can: a shrinking block gives its tail back as a free block, a growing block absorbs
+ *  a free next block, and a block that sits right before the epilogue grows with mem_sbrk. Only if none of that works the payload is
+ *  copied with memcpy to a new block. Unless a hole inside the heap fits, the new block is carved from the top end of the heap (alloc_at_tail),
+ *  so that small blocks allocated later don't end up between the growing block and the epilogue.
+ *
+ *  Requests of up to SLAB_MAX bytes don't get blocks of their own, they get a slot of a slab. A slab is an allocated block of SLAB_SIZE
+ *  bytes whose payload starts on a SLAB_SIZE boundary (alloc_aligned). It is cut into slots of one size class, a bitmap in the slab header
+ *  marks the free slots and __builtin_ctz finds the first one, so slots need no header. Every arena keeps a bitmap of the pages that are slabs,
+ *  which is how mm_free tells a slot from a block. The bitmap is mapped outside the heap, so it doesn't count against utilization.
+ *  A slab whose slots are all free again is given back to the heap with the normal free path.
+ *
+ *  mm_memalign uses the same alloc_aligned for blocks whose payload has to be aligned beyond ALIGNMENT. The bytes in front of the aligned
+ *  payload are split off as a free block of their own, so an aligned block costs no more heap than a normal one of its size.
+ *
+ *  Every arena remembers where the memory it never handed out starts (fresh). That memory is zero: memlib hands out storage no heap
+ *  has reached yet as zero (mem_region_clean), and the only words the heap writes above fresh are the links and footer of the free block
+ *  at its end. Every path that hands out a block moves fresh behind it (use_block), so mm_calloc knows when a block needs no memset.
+ *
+ *  Requests of mmap_threshold bytes or more don't come from an arena at all: mmap_malloc gives each of them a mapping of its own
+ *  (mem_map) and sets the MMAPPED bit in its header. A pointer outside every arena region is such a block, mm_free unmaps it and
+ *  mm_realloc resizes it with mem_remap, so huge blocks never leave holes in the heap behind.
+ *
+ *  mm_walk reports every block of every heap in address order, which is how mdriver takes snapshots of the heap and finds out where
+ *  the free blocks that cost utilization are.
+ *
+ *  The heap checker (arena_check) walks the whole heap. Built with -DMM_DEBUG (make mdriver-debug) the allocator instead checks what
+ *  every operation touches: the returned block and its neighbours (check_block), the merged block of coalesce and the links of every
+ *  block that enters or leaves a free list (check_free_node). The full check runs only every MM_CHECK_EVERY operations of an arena.
  *
  */
 
@@ -24,6 +66,9 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -45,27 +90,42 @@ team_t team = {
         "noemi.kallweit@stud.uni-due.de"
 };
 
-/* single word (4) or double word (8) alignment */
+/* double word (8) alignment, the 64-bit build aligns payloads to 16 bytes instead (make mdriver64) */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
 
 /* Basic constants and macros */
 #define WSIZE 4
 #define DSIZE 8
 #define CHUNKSIZE (1<<12)
 
-/* Minimum size a block can have */
-#define MINIMUM 16
+/* Free list links are native pointers: 4 bytes in the 32-bit build and 8 bytes in the 64-bit build */
+#define LSIZE (sizeof(char *))
+
+/* Minimum size a block can have: header, two free list links and footer (16 bytes in the 32-bit build, 32 in the 64-bit one) */
+#define MINIMUM ALIGN(2*WSIZE + 2*LSIZE)
 
-/* Returns the maximum of two sizes */
+/* Block sizes have to fit into a header, and heap increments into the int that mem_sbrk takes */
+#define MAX_REQUEST (1U<<30)
+
+/* Returns the maximum and the minimum of two sizes */
 #define MAX(x, y) ((x)>(y) ? (x) : (y))
+#define MIN(x, y) ((x)<(y) ? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
 
+/* Header bit that is set if the previous block is allocated */
+#define PREV_ALLOC 0x2
+
+/* Header bit of a block that has a mapping of its own instead of a place in an arena */
+#define MMAPPED 0x4
+#define GET_MMAPPED(p) (GET(p) & MMAPPED)
+
 /* Read and write a word at address p */
 #define GET(p)       (*(unsigned int *)(p))
 #define PUT(p, val)  (*(unsigned int *)(p) = (val))
@@ -73,269 +133,1902 @@ team_t team = {
 /* read size and allocation bit */
 #define GET_SIZE(p)  (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
 
-/* Used for valid heap checking */
-#define GET_ALIGN(p) (GET(p) & 0x7)
+/* set and clear the previous allocated bit in the header at address p */
+#define SET_PREV_ALLOC(p)   PUT(p, GET(p) | PREV_ALLOC)
+#define CLEAR_PREV_ALLOC(p) PUT(p, GET(p) & ~PREV_ALLOC)
 
-/* Given block ptr bp, compute address of its header and footer */
+/* Given block ptr bp, compute address of its header and footer (only free blocks have a footer) */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks (PREV_BLKP only if the previous block is free) */
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
+/* Read and write a free list link at address p */
+#define GET_LINK(p)       (*(char **)(p))
+#define PUT_LINK(p, val)  (*(char **)(p) = (char *)(val))
+
 /* Given block ptr bp of free block, compute address of next and previous free blocks */
-#define NEXT_FREE(bp) (GET(bp + WSIZE))
-#define PREV_FREE(bp) (GET(bp))
+#define NEXT_FREE(bp) GET_LINK((char *)(bp) + LSIZE)
+#define PREV_FREE(bp) GET_LINK(bp)
+
+/* Given block ptr bp of free block, set its next and previous free blocks */
+#define SET_NEXT_FREE(bp, p) PUT_LINK((char *)(bp) + LSIZE, p)
+#define SET_PREV_FREE(bp, p) PUT_LINK(bp, p)
+
+/* The counters of mm_stats cost an add each, -DMM_STATS=0 compiles them out and mm_stats returns zeros */
+#ifndef MM_STATS
+#define MM_STATS 1
+#endif
+#if MM_STATS
+#define STAT_ADD(a, field, n) ((a)->stats.field += (n))
+#define STAT_SUB(a, field, n) ((a)->stats.field -= (n))
+#else
+#define STAT_ADD(a, field, n) ((void)sizeof(n))
+#define STAT_SUB(a, field, n) ((void)sizeof(n))
+#endif
+
+/*
+ * -DMM_DEBUG checks the blocks and free list links that every operation touches, which takes a few steps each, and runs
+ * the full heap checker every MM_CHECK_EVERY operations of an arena (0 means never). A failed check aborts.
+ */
+#ifndef MM_DEBUG
+#define MM_DEBUG 0
+#endif
+#ifndef MM_CHECK_EVERY
+#define MM_CHECK_EVERY 1024
+#endif
+#if MM_DEBUG
+#define DEBUG_BLOCK(a, bp) debug_assert(check_block(a, bp))
+#define DEBUG_NODE(a, bp)  debug_assert(check_free_node(a, bp))
+#define DEBUG_OP(a, bp)    debug_op(a, bp)
+#else
+#define DEBUG_BLOCK(a, bp) ((void)0)
+#define DEBUG_NODE(a, bp)  ((void)0)
+#define DEBUG_OP(a, bp)    ((void)0)
+#endif
+
+/* Number of segregated free lists, the smallest class starts at MINIMUM bytes */
+#define NUM_CLASSES 8
+
+/* Free blocks of TREE_MIN bytes or more, beyond the last class, are kept in a splay tree keyed by size and address */
+#define TREE_MIN (1<<12)
+
+/* Given block ptr bp of a free block in the tree, read and set its children, they take the place of the free list links */
+#define LEFT_CHILD(bp)  GET_LINK(bp)
+#define RIGHT_CHILD(bp) GET_LINK((char *)(bp) + LSIZE)
+#define SET_LEFT_CHILD(bp, p)  PUT_LINK(bp, p)
+#define SET_RIGHT_CHILD(bp, p) PUT_LINK((char *)(bp) + LSIZE, p)
+
+/* Order of the tree: the key of size s1 and address p1 comes before the key of s2 and p2 */
+#define KEY_LESS(s1, p1, s2, p2) ((s1) < (s2) || ((s1) == (s2) && (char *)(p1) < (char *)(p2)))
+
+/* Default number of candidates compared by the good fit policy */
+#define GOOD_FIT_DEFAULT 8
+
+/*
+ * The heap grows by at least a growth step, which starts at CHUNKSIZE. It doubles up to GROW_MAX once GROW_RUN extensions
+ * in a row were used up by fewer than GROW_STORM requests each, and halves again when one lasted more than GROW_CALM requests.
+ */
+#define GROW_MAX (1<<14)
+#define GROW_RUN 4
+#define GROW_STORM 64
+#define GROW_CALM 1024
+
+/*
+ * Requests of MMAP_THRESHOLD bytes or more get a mapping of their own from mem_map, which mm_free unmaps again.
+ * The payload starts ALIGNMENT bytes into the mapping, the header before it holds the size of the mapping.
+ */
+#define MMAP_THRESHOLD_DEFAULT (1<<18)
+#define MMAP_OFFSET ALIGNMENT
+
+/* A free block at the end of the heap that grows past TRIM_THRESHOLD bytes is trimmed down to TRIM_PAD bytes */
+#define TRIM_THRESHOLD_DEFAULT (1<<17)
+#define TRIM_PAD_DEFAULT (1<<15)
+
+/* Number of arenas threads are spread over unless mm_set_arenas asks for another number */
+#define ARENAS_DEFAULT 8
+#define MAX_ARENAS MEM_MAX_REGIONS
+
+/* Requests up to SLAB_MAX bytes are served from slabs: SLAB_SIZE aligned heap blocks cut into slots of one size */
+#define SLAB_SIZE (1<<12)
+#define SLAB_MAX 128
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT)
+#define SLAB_CLASS(size) (((size) + ALIGNMENT - 1) / ALIGNMENT - 1)
+#define SLAB_MAP_WORDS (SLAB_SIZE / ALIGNMENT / 32)
+#define SLAB_FIRST ALIGN(sizeof(slab_t))
+
+/* With deferred coalescing, freed blocks of up to QUICK_MAX bytes wait on a quick list of their exact size */
+#define QUICK_MAX 1024
+#define QUICK_BINS (QUICK_MAX / ALIGNMENT + 1)
+
+/* Per-thread cache: at most TCACHE_COUNT slots of each slab class */
+#define TCACHE_COUNT 7
+
+/* The first word of a payload links blocks on a thread cache bin, a quick list or a remote free queue */
+#define NEXT_CACHED(bp) (*(char **)(bp))
+
+/*
+ * Header at the start of a slab. The slots follow it, a set bit in free_map marks a free slot.
+ * The slab itself is an allocated block of the heap, its slots have no headers of their own.
+ */
+typedef struct slab {
+    struct slab *next;                    /* Slabs of the same class with free slots */
+    struct slab *prev;
+    unsigned int class;                   /* Slab class, the slots are (class + 1) * ALIGNMENT bytes */
+    unsigned int size;                    /* Size of a slot */
+    unsigned int nslots;                  /* Number of slots */
+    unsigned int nfree;                   /* Number of free slots */
+    unsigned int free_map[SLAB_MAP_WORDS];
+} slab_t;
+
+/*
+ * An arena is an independent heap on a memlib region of its own, with its own free lists and lock.
+ * Blocks freed by threads of other arenas are pushed onto remote_frees without taking the lock,
+ * the owner frees them the next time it holds the lock.
+ */
+typedef struct {
+    pthread_mutex_t lock;                 /* Protects everything below but remote_frees */
+    int region;                           /* memlib region of the heap */
+    char *lo, *max;                       /* Extent the region can ever have, to find the arena of a block */
+    char *heap_listp;                     /* Pointer to first block of heap */
+    char *epilogue;                       /* Pointer to epilogue block */
+    char *seg_lists[NUM_CLASSES];         /* Pointers to the first block of each free list */
+    unsigned int seg_mask;                /* Bit i is set if seg_lists[i] is not empty */
+    char *tree;                           /* Root of the tree of free blocks of at least TREE_MIN bytes */
+    char *rovers[NUM_CLASSES];            /* Next fit: where the next search of each class starts */
+    slab_t *slabs[SLAB_CLASSES];          /* Slabs of each class that have free slots */
+    char *slab_base;                      /* SLAB_SIZE aligned address at or below lo */
+    unsigned int *slab_map;               /* Bit i is set if the i-th SLAB_SIZE page above slab_base is a slab */
+    size_t slab_mapsize;                  /* Bytes of the mapping slab_map lives in */
+    char *quick[QUICK_BINS];              /* Deferred coalescing: freed blocks still marked allocated, by size / ALIGNMENT */
+    unsigned int quick_blocks;            /* Number of blocks on the quick lists */
+    size_t grow_step;                     /* Smallest number of bytes the heap grows by */
+    unsigned int requests;                /* Number of allocations, to tell how fast the heap fills up */
+    unsigned int grow_requests;           /* Value of requests at the last extension */
+    int fast_grows;                       /* Extensions in a row that were used up by few requests */
+    char *fresh;                          /* Heap memory from here on was never handed out and is still zero */
+    int fresh_block;                      /* Set if the block handed out last was fresh memory */
+    mm_stats_t stats;                     /* Counters returned by mm_stats */
+    unsigned int check_ops;               /* MM_DEBUG: operations since the last full check */
+    char *remote_frees;                   /* Lock-free stack of blocks freed by other arenas' threads */
+} arena_t;
+
+/*
+ * A thread's cache of slab slots it freed. The slots stay marked allocated in their slab,
+ * so mm_malloc and mm_free of a cached size don't need the arena lock.
+ */
+typedef struct {
+    unsigned int generation;              /* Heap generation the cache belongs to, 0 if unused */
+    arena_t *arena;                       /* Arena of the thread */
+    char *bins[SLAB_CLASSES];             /* Cached slots, one list per slab class */
+    int counts[SLAB_CLASSES];
+} tcache_t;
 
 /* Global variables */
-static char *heap_listp;  /* Pointer to first block of heap */
-char *free_listp;         /* Pointer to first block of freelist */
+static arena_t arenas[MAX_ARENAS];
+static int num_arenas;                    /* Arenas threads are spread over */
+static int live_arenas;                   /* Arenas that have a heap in this generation */
+static int created_arenas;                /* Arenas whose lock and region exist */
+static int next_thread;                   /* Round robin counter to assign threads to arenas */
+static int next_arenas = ARENAS_DEFAULT;
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Incremented by every mm_init, thread caches of an older generation are stale */
+static unsigned int generation = 0;
+static __thread tcache_t tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+/* Placement policy used by find_fit and the one requested for the next mm_init */
+static mm_policy_t policy = MM_FIRST_FIT;
+static int fit_limit = 1;               /* Number of fitting candidates to compare, 0 means all */
+static mm_policy_t next_policy = MM_FIRST_FIT;
+static int next_nfit = GOOD_FIT_DEFAULT;
 
-/* Pointer to epilogue block */
-char *epilogue = 0;
+/* Trimming of the heap, 0 means never, and the values for the next mm_init */
+static size_t trim_threshold;
+static size_t trim_pad;
+static size_t next_trim_threshold = TRIM_THRESHOLD_DEFAULT;
+static size_t next_trim_pad = TRIM_PAD_DEFAULT;
+
+/* Smallest request that gets a mapping of its own, 0 means none does, and the value for the next mm_init */
+static size_t mmap_threshold;
+static size_t next_mmap_threshold = MMAP_THRESHOLD_DEFAULT;
+
+/* Whether freed blocks wait on quick lists before they are coalesced, and the value for the next mm_init */
+static int deferred;
+static int next_deferred = 0;
 
 /* Declarations */
-static void *find_fit(size_t asize);
-static void *extend_heap(size_t words);
-static void place(void *bp, size_t asize);
-static void *coalesce(void *bp);
-static void add_freeblock(void *bp);
-static void remove_freeblock(void *bp);
-static int mm_check();
+static int arena_init(arena_t *a);
+static arena_t *arena_of(void *bp);
+static tcache_t *thread_cache(void);
+static void tcache_flush(void *arg);
+static void tcache_key_init(void);
+static void drain_remote_frees(arena_t *a);
+static void *mmap_malloc(size_t size);
+static void *mmap_realloc(void *ptr, size_t size);
+static void *arena_malloc(arena_t *a, size_t size);
+static void *block_malloc(arena_t *a, size_t asize);
+static int arena_malloc_batch(arena_t *a, size_t size, int n, void **ptrs);
+static void queue_remote_free(arena_t *a, void *bp);
+static int compare_ptrs(const void *p, const void *q);
+static void arena_free(arena_t *a, void *bp);
+static void *arena_realloc(arena_t *a, void *ptr, size_t size);
+static void free_block(arena_t *a, void *bp);
+static void *fit_or_consolidate(arena_t *a, size_t asize);
+static void consolidate(arena_t *a);
+static slab_t *slab_of(arena_t *a, void *bp);
+static void *slab_alloc(arena_t *a, int class);
+static void slab_free(arena_t *a, slab_t *s, void *bp);
+static slab_t *slab_create(arena_t *a, int class);
+static void slab_link(arena_t *a, slab_t *s);
+static void slab_unlink(arena_t *a, slab_t *s);
+static void *alloc_aligned(arena_t *a, size_t asize, size_t align);
+static void *aligned_fit(arena_t *a, size_t asize, size_t align);
+static char *aligned_spot(char *bp, size_t asize, size_t align);
+static void *find_fit(arena_t *a, size_t asize);
+static void *fit_in_list(arena_t *a, char *bp, size_t asize);
+static void *next_fit(arena_t *a, int class, size_t asize);
+static void *extend_heap(arena_t *a, size_t words);
+static size_t grow_size(arena_t *a, size_t asize);
+static void *heap_sbrk(arena_t *a, size_t size);
+static void place(arena_t *a, void *bp, size_t asize);
+static void use_block(arena_t *a, char *bp);
+static void *alloc_at_tail(arena_t *a, size_t asize);
+static void resize_block(arena_t *a, void *bp, size_t csize, size_t asize);
+static void trim_heap(arena_t *a, void *bp);
+static size_t adjust_size(size_t size);
+static void *coalesce(arena_t *a, void *bp);
+static void add_freeblock(arena_t *a, void *bp);
+static void remove_freeblock(arena_t *a, void *bp);
+static int size_class(size_t size);
+static char *tree_splay(char *t, size_t size, char *bp);
+static void tree_insert(arena_t *a, char *bp);
+static void tree_remove(arena_t *a, char *bp);
+static char *tree_best_fit(arena_t *a, size_t asize);
+static char *tree_successor(arena_t *a, char *bp);
+static int check_tree(arena_t *a);
+static int check_tree_node(char *t, char *lo, char *hi, int depth);
+static int check_slabs(arena_t *a);
+static int check_quick(arena_t *a);
+static int arena_check(arena_t *a);
+static int mm_check(void);
+#if MM_DEBUG
+static int check_block(arena_t *a, char *bp);
+static int check_free_node(arena_t *a, char *bp);
+static void debug_op(arena_t *a, void *bp);
+static void debug_assert(int ok);
+#endif
+
+/*
+ * initializes the allocator: arena 0 gets the heap of mem_sbrk, the other arenas start over the next time a thread needs them
+ */
+int mm_init(void)
+{
+    int i;
+
+    policy = next_policy;                                                       // the placement policy is fixed for the lifetime of the heap
+    if (policy == MM_FIRST_FIT || policy == MM_NEXT_FIT)
+        fit_limit = 1;
+    else if (policy == MM_GOOD_FIT)
+        fit_limit = next_nfit;
+    else
+        fit_limit = 0;
+    trim_threshold = next_trim_threshold;
+    trim_pad = next_trim_pad;
+    deferred = next_deferred;
+    mmap_threshold = next_mmap_threshold;
+
+    if (created_arenas == 0) {                                                  // the first arena always lives on region 0
+        pthread_mutex_init(&arenas[0].lock, NULL);
+        arenas[0].region = 0;
+        created_arenas = 1;
+    }
+    for (i = 0; i < created_arenas; i++)
+        arenas[i].remote_frees = NULL;                                          // blocks of the old heap are gone
+    num_arenas = next_arenas;
+    live_arenas = 1;
+    next_thread = 0;
+    generation++;                                                               // makes every thread cache stale
+
+    return arena_init(&arenas[0]);
+}
+
+/*
+ * selects the placement policy used by the heap that the next mm_init creates
+ */
+void mm_set_policy(mm_policy_t new_policy, int nfit)
+{
+    next_policy = new_policy;
+    next_nfit = (nfit > 0) ? nfit : GOOD_FIT_DEFAULT;                          // good fit has to compare at least one candidate
+}
+
+/*
+ * selects when the heap that the next mm_init creates gives memory back: once the free block at its end is larger than
+ * threshold bytes, it is cut down to pad bytes. The gap between the two keeps a heap that shrinks and grows by a little
+ * from trimming and extending over and over. A threshold of 0 turns trimming off.
+ */
+void mm_set_trim(size_t threshold, size_t pad)
+{
+    if (threshold != 0 && pad >= threshold)                                     // the pad has to stay below the threshold
+        pad = threshold / 2;
+    pad = ALIGN(pad);
+    if (pad < MINIMUM)                                                          // a smaller rest can't be a block of its own
+        pad = 0;
+    next_trim_threshold = threshold;
+    next_trim_pad = pad;
+}
+
+/*
+ * selects whether the heap that the next mm_init creates defers coalescing: freed blocks of up to QUICK_MAX bytes stay
+ * marked allocated on quick lists, where a request of the same size takes them back without a split. They are freed
+ * and coalesced only when a request finds no fit, before the heap is extended.
+ */
+void mm_set_deferred(int on)
+{
+    next_deferred = on;
+}
+
+/*
+ * selects the smallest request that gets a mapping of its own in the heap that the next mm_init creates, 0 turns mappings off.
+ * Such blocks don't fragment the heap when they are freed, their pages go back to the system at once.
+ */
+void mm_set_mmap_threshold(size_t threshold)
+{
+    next_mmap_threshold = threshold;
+}
+
+/*
+ * selects the number of arenas that threads are spread over after the next mm_init
+ */
+void mm_set_arenas(int n)
+{
+    if (n < 1)
+        n = 1;
+    next_arenas = (n > MAX_ARENAS) ? MAX_ARENAS : n;
+}
+
+/*
+ * returns the counters of the heap that the last mm_init created, summed over its arenas. Allocations served by a thread
+ * cache don't reach an arena and aren't counted.
+ */
+mm_stats_t mm_stats(void)
+{
+    mm_stats_t total;
+    size_t *sum = (size_t *)&total, *add;
+    arena_t *a;
+    int i, j;
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < live_arenas && MM_STATS; i++) {
+        a = &arenas[i];
+        add = (size_t *)&a->stats;
+        pthread_mutex_lock(&a->lock);
+        for (j = 0; j < (int)(sizeof(mm_stats_t) / sizeof(size_t)); j++)        // every field is a size_t, grow_step is the max below
+            sum[j] += add[j];
+        total.grow_step = MAX(total.grow_step, a->grow_step);
+        pthread_mutex_unlock(&a->lock);
+    }
+    return total;
+}
+
+/*
+ * calls f for every block of the heap of each arena, from the block after the prologue up to the epilogue
+ */
+void mm_walk(mm_walk_fn f, void *arg)
+{
+    arena_t *a;
+    char *bp;
+    mm_block_t state;
+    int i;
+
+    for (i = 0; i < live_arenas; i++) {
+        a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        for (bp = NEXT_BLKP(a->heap_listp); HDRP(bp) != a->epilogue; bp = NEXT_BLKP(bp)) {
+            if (!GET_ALLOC(HDRP(bp)))
+                state = MM_BLOCK_FREE;
+            else if ((char *)slab_of(a, bp) == bp)                              // the payload of a slab starts with its slab_t
+                state = MM_BLOCK_SLAB;
+            else
+                state = MM_BLOCK_ALLOC;
+            f(arg, i, bp, GET_SIZE(HDRP(bp)), state);
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+}
+
+/*
+ * allocates a block on the heap
+ */
+void *mm_malloc(size_t size)
+{
+    tcache_t *tc;
+    arena_t *a;
+    char *bp;
+    int class;
+
+    if (size == 0 || size > MAX_REQUEST || generation == 0)                     // if the block's size is 0 or too large or there is no heap, do nothing
+        return NULL;
+    if (mmap_threshold != 0 && size >= mmap_threshold)                          // huge blocks don't need an arena or its lock
+        return mmap_malloc(size);
+
+    tc = thread_cache();
+    class = SLAB_CLASS(size);
+    if (size <= SLAB_MAX && (bp = tc->bins[class]) != NULL) {                   // a cached slot of that class needs no lock
+        tc->bins[class] = NEXT_CACHED(bp);
+        tc->counts[class]--;
+        return bp;
+    }
+
+    a = tc->arena;
+    pthread_mutex_lock(&a->lock);
+    drain_remote_frees(a);
+    bp = arena_malloc(a, size);
+    DEBUG_OP(a, bp);
+    pthread_mutex_unlock(&a->lock);
+    return bp;
+}
+
+/*
+ * allocates a block on the heap whose payload is aligned to align bytes, a power of two. It is placed in a free block
+ * with room for the aligned payload, the bytes in front of it become a free block of their own instead of being wasted.
+ * Aligned blocks always live in the heap, even the huge ones, a mapping only aligns its payload to ALIGNMENT.
+ */
+void *mm_memalign(size_t align, size_t size)
+{
+    arena_t *a;
+    size_t asize;
+    char *bp;
+
+    if (align == 0 || (align & (align - 1)) != 0)                               // alignments are powers of two
+        return NULL;
+    if (align <= ALIGNMENT)                                                     // every block is aligned that far
+        return mm_malloc(size);
+    if (size == 0 || size > MAX_REQUEST || generation == 0)
+        return NULL;
+    asize = adjust_size(size);
+    if (align > MAX_REQUEST - asize)                                            // the heap may have to grow by both
+        return NULL;
+
+    a = thread_cache()->arena;
+    pthread_mutex_lock(&a->lock);
+    drain_remote_frees(a);
+    a->requests++;
+    if ((bp = alloc_aligned(a, asize, align)) != NULL) {
+        STAT_ADD(a, mallocs, 1);
+        STAT_ADD(a, malloc_bytes, size);
+        STAT_ADD(a, block_bytes, GET_SIZE(HDRP(bp)));
+    }
+    DEBUG_OP(a, bp);
+    pthread_mutex_unlock(&a->lock);
+    return bp;
+}
+
+/*
+ * allocates a block for nmemb elements of size bytes and clears it. A block cut from heap memory that was never handed
+ * out is zero already, apart from the links and footer it had as a free block, so only those words are cleared.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    arena_t *a;
+    size_t total;
+    char *bp;
+    int fresh;
+
+    if (size != 0 && nmemb > MAX_REQUEST / size)                                // the product doesn't fit into a block
+        return NULL;
+    total = nmemb * size;
+    if (total == 0 || generation == 0)
+        return NULL;
+    if (mmap_threshold != 0 && total >= mmap_threshold)                         // a new mapping is zero
+        return mmap_malloc(total);
+    if (total <= SLAB_MAX) {                                                    // slots are small, clearing them is cheap
+        if ((bp = mm_malloc(total)) != NULL)
+            memset(bp, 0, total);
+        return bp;
+    }
+
+    a = thread_cache()->arena;
+    pthread_mutex_lock(&a->lock);
+    drain_remote_frees(a);
+    a->fresh_block = 0;                                                         // blocks taken back from the quick lists aren't fresh
+    bp = arena_malloc(a, total);
+    fresh = a->fresh_block;
+    DEBUG_OP(a, bp);
+    pthread_mutex_unlock(&a->lock);
+    if (bp == NULL)
+        return NULL;
+
+    if (fresh) {
+        memset(bp, 0, 2*LSIZE);                                                 // the free list links or tree children
+        PUT(bp + GET_SIZE(HDRP(bp)) - DSIZE, 0);                                // and the footer, if the block took all of the free one
+    }
+    else
+        memset(bp, 0, total);
+    return bp;
+}
+
+/*
+ * remove the block from the malloc list and free the place
+ */
+void mm_free(void *ptr)
+{
+    tcache_t *tc;
+    arena_t *a;
+    slab_t *s;
+
+    if(ptr == NULL || generation == 0)                                          // if freeing nothing or if heap isn't initialized yet, return
+        return;
+
+    if ((a = arena_of(ptr)) == NULL) {                                          // the block has a mapping of its own
+        mem_unmap((char *)ptr - MMAP_OFFSET);
+        return;
+    }
+    tc = thread_cache();
+    if (a != tc->arena) {                                                       // the block belongs to another arena, queue it for its owner
+        queue_remote_free(a, ptr);
+        return;
+    }
+
+    if ((s = slab_of(a, ptr)) != NULL && tc->counts[s->class] < TCACHE_COUNT) { // slab slots go to the thread cache, still marked allocated
+        NEXT_CACHED(ptr) = tc->bins[s->class];
+        tc->bins[s->class] = ptr;
+        tc->counts[s->class]++;
+        return;
+    }
+
+    pthread_mutex_lock(&a->lock);
+    drain_remote_frees(a);
+    arena_free(a, ptr);
+    DEBUG_OP(a, NULL);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/*
+ * takes arenas_lock and then the lock of every arena that has one, the order in which thread_cache and the arenas take them
+ */
+void mm_fork_prepare(void)
+{
+    int i;
+
+    pthread_mutex_lock(&arenas_lock);
+    for (i = 0; i < created_arenas; i++)                                        // arenas_lock keeps created_arenas from changing
+        pthread_mutex_lock(&arenas[i].lock);
+}
+
+/*
+ * releases the locks that mm_fork_prepare took, in the parent after the fork
+ */
+void mm_fork_parent(void)
+{
+    int i;
+
+    for (i = created_arenas - 1; i >= 0; i--)
+        pthread_mutex_unlock(&arenas[i].lock);
+    pthread_mutex_unlock(&arenas_lock);
+}
+
+/*
+ * gives the child fresh, unlocked copies of the locks. The caches of the other threads are lost with them, their slots stay allocated.
+ */
+void mm_fork_child(void)
+{
+    int i;
+
+    for (i = 0; i < created_arenas; i++)
+        pthread_mutex_init(&arenas[i].lock, NULL);
+    pthread_mutex_init(&arenas_lock, NULL);
+}
+
+/*
+ * allocates n blocks for payloads of size bytes with a single lock of the arena and stores them in ptrs.
+ * Returns the number of blocks allocated, which is less than n only if the heap ran out of memory.
+ */
+int mm_malloc_batch(size_t size, int n, void **ptrs)
+{
+    tcache_t *tc;
+    arena_t *a;
+    int class, done = 0;
+
+    if (n <= 0 || size == 0 || size > MAX_REQUEST || generation == 0)
+        return 0;
+    if (mmap_threshold != 0 && size >= mmap_threshold) {                        // a mapping each, the arena isn't involved
+        for (; done < n && (ptrs[done] = mmap_malloc(size)) != NULL; done++)
+            ;
+        return done;
+    }
+
+    tc = thread_cache();
+    class = SLAB_CLASS(size);
+    if (size <= SLAB_MAX) {                                                     // use up the cached slots first
+        for (; done < n && tc->bins[class] != NULL; done++) {
+            ptrs[done] = tc->bins[class];
+            tc->bins[class] = NEXT_CACHED(ptrs[done]);
+            tc->counts[class]--;
+        }
+        if (done == n)
+            return n;
+    }
+
+    a = tc->arena;
+    pthread_mutex_lock(&a->lock);
+    drain_remote_frees(a);
+    done += arena_malloc_batch(a, size, n - done, ptrs + done);
+    DEBUG_OP(a, NULL);
+    pthread_mutex_unlock(&a->lock);
+    return done;
+}
+
+/*
+ * frees the n blocks in ptrs with a single lock of the arena. Slab slots go to the thread cache or back to their slabs,
+ * the heap blocks are moved to the front of ptrs and sorted by address, so blocks that lie next to each other on the heap
+ * are merged into one free block and coalesced once. NULL pointers are skipped.
+ */
+void mm_free_batch(int n, void **ptrs)
+{
+    tcache_t *tc;
+    arena_t *a;
+    slab_t *s;
+    size_t size;
+    int i, j;
+
+    if (n <= 0 || generation == 0)
+        return;
+
+    tc = thread_cache();
+    a = tc->arena;
+    for (i = 0, j = 0; i < n; i++) {                                            // what the thread cache takes doesn't need the lock
+        if (ptrs[i] == NULL)
+            continue;
+        if (arena_of(ptrs[i]) == NULL)                                          // mappings are given back right away
+            mem_unmap((char *)ptrs[i] - MMAP_OFFSET);
+        else if (arena_of(ptrs[i]) != a)                                        // blocks of other arenas are queued for their owners
+            queue_remote_free(arena_of(ptrs[i]), ptrs[i]);
+        else if ((s = slab_of(a, ptrs[i])) != NULL && tc->counts[s->class] < TCACHE_COUNT) {
+            NEXT_CACHED(ptrs[i]) = tc->bins[s->class];
+            tc->bins[s->class] = ptrs[i];
+            tc->counts[s->class]++;
+        }
+        else
+            ptrs[j++] = ptrs[i];                                                // the rest moves to the front
+    }
+    if ((n = j) == 0)
+        return;
+
+    pthread_mutex_lock(&a->lock);
+    drain_remote_frees(a);
+    for (i = 0, j = 0; i < n; i++) {                                            // slots go back to their slabs, they don't coalesce
+        if ((s = slab_of(a, ptrs[i])) != NULL)
+            slab_free(a, s, ptrs[i]);
+        else
+            ptrs[j++] = ptrs[i];
+    }
+    n = j;
+    qsort(ptrs, n, sizeof(void *), compare_ptrs);
+    for (i = 0; i < n; i = j) {
+        j = i + 1;
+        size = GET_SIZE(HDRP(ptrs[i]));
+        for (; j < n && (char *)ptrs[j] == (char *)ptrs[i] + size; j++)         // the next block on the heap is freed as well, merge it
+            size += GET_SIZE(HDRP(ptrs[j]));
+        PUT(HDRP(ptrs[i]), PACK(size, 1 | GET_PREV_ALLOC(HDRP(ptrs[i]))));
+        free_block(a, ptrs[i]);
+    }
+    DEBUG_OP(a, NULL);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/*
+ * resizes a block in place if possible, otherwise moves it with memcpy, the block stays in the arena it belongs to
+ */
+void *mm_realloc(void *ptr, size_t size){
+    arena_t *a;
+    void *newptr;
+
+    if (ptr == NULL)                                                            // realloc of nothing is a malloc
+        return mm_malloc(size);
+    if (size == 0) {                                                            // realloc to 0 bytes is a free
+        mm_free(ptr);
+        return NULL;
+    }
+    if (size > MAX_REQUEST)                                                     // the old block stays as it is
+        return NULL;
+
+    if ((a = arena_of(ptr)) == NULL)                                            // heap blocks that grow stay in their arena, where they can grow in place
+        return mmap_realloc(ptr, size);
+    pthread_mutex_lock(&a->lock);
+    drain_remote_frees(a);
+    newptr = arena_realloc(a, ptr, size);
+    DEBUG_OP(a, newptr);
+    pthread_mutex_unlock(&a->lock);
+    return newptr;
+}
+
+/*
+ * returns the payload bytes of block ptr: the whole slot of a slab, or the block without its header
+ */
+size_t mm_usable_size(void *ptr)
+{
+    arena_t *a;
+    slab_t *s;
+
+    if (ptr == NULL)
+        return 0;
+    if ((a = arena_of(ptr)) == NULL)                                            // the block has a mapping of its own
+        return GET_SIZE(HDRP(ptr)) - MMAP_OFFSET;
+    if ((s = slab_of(a, ptr)) != NULL)                                          // a slot's size can't change while it is live
+        return s->size;
+    return GET_SIZE(HDRP(ptr)) - WSIZE;                                         // allocated blocks have no footer
+}
+
+/*
+ * creates an empty heap with a prologue, an epilogue and one free block of CHUNKSIZE bytes in the region of arena a
+ */
+static int arena_init(arena_t *a)
+{
+    size_t pages, mapsize;
+
+    a->lo = mem_region_lo(a->region);
+    a->max = mem_region_max(a->region);
+    a->slab_base = (char *)((uintptr_t)a->lo & ~(uintptr_t)(SLAB_SIZE - 1));
+    pages = (a->max - a->slab_base + SLAB_SIZE - 1) / SLAB_SIZE;
+    mapsize = ALIGN((pages + 31) / 32 * sizeof(unsigned int));
+    if (a->slab_map != NULL && a->slab_mapsize == mapsize)                      // the page map of the slabs isn't part of the heap,
+        memset(a->slab_map, 0, mapsize);                                        // so it doesn't count against utilization or depend on -H
+    else {
+        if (a->slab_map != NULL)
+            munmap(a->slab_map, a->slab_mapsize);
+        if ((a->slab_map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,          // fresh pages are zero, only the part in use gets touched
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+            a->slab_map = NULL;
+            return -1;
+        }
+        a->slab_mapsize = mapsize;
+    }
+    memset(a->slabs, 0, sizeof(a->slabs));
+    memset(a->quick, 0, sizeof(a->quick));
+    a->quick_blocks = 0;
+    memset(&a->stats, 0, sizeof(a->stats));
+    a->grow_step = CHUNKSIZE;
+    a->requests = a->grow_requests = 0;
+    a->fast_grows = 0;
+    a->check_ops = 0;
+
+    if ((a->heap_listp = mem_region_sbrk(a->region, 4*WSIZE)) == (void *)-1)    // create the initial empty heap
+        return -1;
+    PUT(a->heap_listp, 0);                                                      // alignment padding
+    PUT(a->heap_listp + (1*WSIZE), PACK(DSIZE, 1 | PREV_ALLOC));                // set the prologue header
+    PUT(a->heap_listp + (2*WSIZE), PACK(DSIZE, 1));                             // set the prologue footer
+    PUT(a->heap_listp + (3*WSIZE), PACK(0, 1 | PREV_ALLOC));                    // set the epilogue header, the prologue before it is allocated
+    a->epilogue = (a->heap_listp + (3*WSIZE));
+    a->heap_listp += (2*WSIZE);
+    a->fresh = MAX(a->epilogue + WSIZE, (char *)mem_region_clean(a->region));   // an earlier heap may have left its bytes above brk
+    memset(a->seg_lists, 0, sizeof(a->seg_lists));                              // initialize all free lists to be empty
+    memset(a->rovers, 0, sizeof(a->rovers));
+    a->seg_mask = 0;
+    a->tree = NULL;
+
+    if (extend_heap(a, CHUNKSIZE/WSIZE) == NULL)                                // extend the empty heap with a free block of CHUNKSIZE bytes
+        return -1;
+    return 0;
+}
+
+/*
+ * returns the arena whose region holds block bp, or NULL if bp has a mapping of its own
+ */
+static arena_t *arena_of(void *bp)
+{
+    int n = __atomic_load_n(&live_arenas, __ATOMIC_ACQUIRE);                    // arenas may be added while we look
+    int i;
+    for (i = 0; i < n; i++) {                                                   // most blocks live in arena 0
+        if ((char *)bp >= arenas[i].lo && (char *)bp < arenas[i].max)
+            return &arenas[i];
+    }
+    return NULL;
+}
+
+/*
+ * gives a block of size bytes a mapping of its own, no arena is involved. The header holds the size of the mapping.
+ */
+static void *mmap_malloc(size_t size)
+{
+    size_t msize = ALIGN(size + MMAP_OFFSET);
+    char *bp;
+
+    msize = (msize + mem_pagesize() - 1) & ~(mem_pagesize() - 1);               // mem_map rounds up to whole pages, the header tells the truth
+    if ((bp = mem_map(msize)) == (void *)-1)
+        return NULL;
+    bp += MMAP_OFFSET;
+    PUT(HDRP(bp), PACK(msize, MMAPPED | 1));
+    return bp;
+}
+
+/*
+ * resizes block ptr, which has a mapping of its own. As long as it is large enough for one the mapping is remapped, the kernel
+ * moves its pages instead of copying them. A block that shrinks below the threshold moves back into the heap.
+ */
+static void *mmap_realloc(void *ptr, size_t size)
+{
+    size_t msize = (ALIGN(size + MMAP_OFFSET) + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    char *bp;
+
+    if (mmap_threshold != 0 && size >= mmap_threshold) {
+        if (msize == GET_SIZE(HDRP(ptr)))                                       // the pages it has are enough
+            return ptr;
+        if ((bp = mem_remap((char *)ptr - MMAP_OFFSET, msize)) == (void *)-1)
+            return NULL;
+        bp += MMAP_OFFSET;
+        PUT(HDRP(bp), PACK(msize, MMAPPED | 1));
+        return bp;
+    }
+
+    if ((bp = mm_malloc(size)) == NULL)
+        return NULL;
+    memcpy(bp, ptr, MIN(GET_SIZE(HDRP(ptr)) - MMAP_OFFSET, size));
+    mem_unmap((char *)ptr - MMAP_OFFSET);
+    return bp;
+}
+
+/*
+ * returns the cache of the calling thread; a thread that is new or whose cache is stale is assigned to an arena in round robin order
+ */
+static tcache_t *thread_cache(void)
+{
+    tcache_t *tc = &tcache;
+    arena_t *a;
+    int i;
+
+    if (tc->generation == generation)                                           // the common case: nothing to do
+        return tc;
+
+    memset(tc, 0, sizeof(*tc));                                                 // blocks of an old heap are gone
+    pthread_once(&tcache_once, tcache_key_init);
+    pthread_setspecific(tcache_key, tc);                                        // flush the cache when the thread exits
+
+    pthread_mutex_lock(&arenas_lock);
+    i = next_thread++ % num_arenas;
+    a = &arenas[i];
+    while (live_arenas <= i) {                                                  // arenas are set up the first time a thread needs one
+        a = &arenas[live_arenas];
+        if (live_arenas == created_arenas) {
+            if ((a->region = mem_region_create()) < 0)
+                break;
+            pthread_mutex_init(&a->lock, NULL);
+            created_arenas++;
+        }
+        a->remote_frees = NULL;
+        mem_region_reset_brk(a->region);                                        // the heap of an earlier generation is gone
+        if (arena_init(a) < 0)
+            break;
+        __atomic_store_n(&live_arenas, live_arenas + 1, __ATOMIC_RELEASE);      // publish the arena once it is set up
+    }
+    if (live_arenas <= i)                                                       // out of regions, share the last arena that works
+        a = &arenas[live_arenas - 1];
+    pthread_mutex_unlock(&arenas_lock);
+
+    tc->arena = a;
+    tc->generation = generation;
+    return tc;
+}
+
+/*
+ * gives the blocks in the cache of an exiting thread back to its arena
+ */
+static void tcache_flush(void *arg)
+{
+    tcache_t *tc = arg;
+    char *bp, *next;
+    int i;
+
+    if (tc->generation != generation)                                           // the blocks belong to a heap that is gone
+        return;
+    pthread_mutex_lock(&tc->arena->lock);
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        for (bp = tc->bins[i]; bp != NULL; bp = next) {
+            next = NEXT_CACHED(bp);
+            arena_free(tc->arena, bp);
+        }
+    }
+    pthread_mutex_unlock(&tc->arena->lock);
+    tc->generation = 0;
+}
+
+/*
+ * creates the key whose destructor flushes thread caches
+ */
+static void tcache_key_init(void)
+{
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+
+/*
+ * frees the blocks that other threads queued on arena a, the caller holds the lock of a
+ */
+static void drain_remote_frees(arena_t *a)
+{
+    char *bp, *next;
+
+    if (__atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED) == NULL)            // cheap test first, the queue is usually empty
+        return;
+    bp = __atomic_exchange_n(&a->remote_frees, NULL, __ATOMIC_ACQUIRE);         // take the whole queue at once
+    for (; bp != NULL; bp = next) {
+        next = NEXT_CACHED(bp);
+        arena_free(a, bp);
+    }
+}
+
+/*
+ * allocates a block for a payload of size bytes in arena a, small requests get a slot of a slab
+ */
+static void *arena_malloc(arena_t *a, size_t size)
+{
+    size_t bsize;
+    char *bp;
+
+    a->requests++;
+    if (size <= SLAB_MAX) {
+        bp = slab_alloc(a, SLAB_CLASS(size));
+        bsize = (SLAB_CLASS(size) + 1) * ALIGNMENT;
+    }
+    else {
+        bp = block_malloc(a, adjust_size(size));                                // add the header and align the size
+        bsize = (bp != NULL) ? GET_SIZE(HDRP(bp)) : 0;
+    }
+    if (bp != NULL) {                                                           // what the block has beyond size is internal fragmentation
+        STAT_ADD(a, mallocs, 1);
+        STAT_ADD(a, malloc_bytes, size);
+        STAT_ADD(a, block_bytes, bsize);
+    }
+    return bp;
+}
+
+/*
+ * allocates a heap block of asize bytes in arena a
+ */
+static void *block_malloc(arena_t *a, size_t asize)
+{
+    size_t extendsize;
+    char *bp;
+
+    if (asize <= QUICK_MAX && (bp = a->quick[asize / ALIGNMENT]) != NULL) {     // a deferred block of that size is taken back as it is
+        a->quick[asize / ALIGNMENT] = NEXT_CACHED(bp);
+        a->quick_blocks--;
+        return bp;
+    }
+
+    if ((bp = fit_or_consolidate(a, asize)) != NULL){                           // search for a fit and places the block if one is found
+        place(a, bp, asize);
+        return bp;
+    }
+    extendsize = grow_size(a, asize);                                           // how much the heap has to grow, at least by the growth step
+    if ((bp = extend_heap(a, extendsize/WSIZE)) == NULL)                        // if no fit was found the heap needs to be extended
+        return NULL;
+    place(a, bp, asize);
+    return bp;
+}
+
+/*
+ * allocates n blocks for payloads of size bytes in arena a and returns how many it got. Larger blocks are cut from
+ * a single fit for all of them, so the free lists are searched once per batch instead of once per block.
+ */
+static int arena_malloc_batch(arena_t *a, size_t size, int n, void **ptrs)
+{
+    size_t asize, csize, prev_alloc;
+    char *bp;
+    int i, k, done = 0;
+
+    if (size <= SLAB_MAX) {
+        a->requests += n;
+        for (; done < n && (ptrs[done] = slab_alloc(a, SLAB_CLASS(size))) != NULL; done++)
+            ;
+        STAT_ADD(a, mallocs, done);
+        STAT_ADD(a, malloc_bytes, done * size);
+        STAT_ADD(a, block_bytes, done * (SLAB_CLASS(size) + 1) * ALIGNMENT);
+        return done;
+    }
+
+    asize = adjust_size(size);
+    a->requests += n;
+    while (done < n) {
+        k = (int)MIN((size_t)(n - done), MAX(MAX_REQUEST / asize, 1));          // keep the size of one fit within bounds
+        if ((bp = fit_or_consolidate(a, k * asize)) == NULL &&
+            (bp = extend_heap(a, grow_size(a, k * asize)/WSIZE)) == NULL)
+            return done;
+        place(a, bp, k * asize);
+
+        csize = GET_SIZE(HDRP(bp));                                             // cut the placed block into k blocks, the last one keeps any rest
+        prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+        for (i = 1; i < k; i++) {
+            PUT(HDRP(bp), PACK(asize, 1 | prev_alloc));
+            ptrs[done++] = bp;
+            bp = NEXT_BLKP(bp);
+            csize -= asize;
+            prev_alloc = PREV_ALLOC;
+        }
+        PUT(HDRP(bp), PACK(csize, 1 | prev_alloc));
+        ptrs[done++] = bp;
+        STAT_ADD(a, mallocs, k);
+        STAT_ADD(a, malloc_bytes, k * size);
+        STAT_ADD(a, block_bytes, (k - 1) * asize + csize);
+    }
+    return done;
+}
+
+/*
+ * pushes block bp on the queue of remote frees of arena a, which its owner drains the next time it takes the lock
+ */
+static void queue_remote_free(arena_t *a, void *bp)
+{
+    char *head = __atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED);
+
+    do {
+        NEXT_CACHED(bp) = head;
+    } while (!__atomic_compare_exchange_n(&a->remote_frees, &head, bp, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * orders pointers by address for qsort
+ */
+static int compare_ptrs(const void *p, const void *q)
+{
+    uintptr_t x = (uintptr_t)*(void * const *)p, y = (uintptr_t)*(void * const *)q;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * frees block or slot bp of arena a
+ */
+static void arena_free(arena_t *a, void *bp)
+{
+    slab_t *s = slab_of(a, bp);
+    size_t size;
+
+    if (s != NULL)
+        slab_free(a, s, bp);
+    else if (deferred && (size = GET_SIZE(HDRP(bp))) <= QUICK_MAX) {            // the block waits on a quick list, still marked allocated
+        NEXT_CACHED(bp) = a->quick[size / ALIGNMENT];
+        a->quick[size / ALIGNMENT] = bp;
+        a->quick_blocks++;
+    }
+    else
+        free_block(a, bp);
+}
+
+/*
+ * frees heap block bp of arena a
+ */
+static void free_block(arena_t *a, void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));                                           // get size of the block
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));                        // set allocation bit in header to 0, keep the previous block's bit
+    PUT(FTRP(bp), PACK(size, 0));                                               // a free block needs a footer again
+    CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));                                      // tell the next block that this one is free
+    trim_heap(a, coalesce(a, bp));                                              // coalesce the block, if needed, and give the end of the heap back if it got too large
+}
+
+/*
+ * searches a fit with find_fit, if there is none the deferred blocks are coalesced and it searches once more
+ */
+static void *fit_or_consolidate(arena_t *a, size_t asize)
+{
+    char *bp = find_fit(a, asize);
+
+    if (bp == NULL && a->quick_blocks != 0) {
+        consolidate(a);
+        bp = find_fit(a, asize);
+    }
+    STAT_ADD(a, fit_searches, 1);
+    if (bp == NULL)
+        STAT_ADD(a, fit_misses, 1);
+    return bp;
+}
+
+/*
+ * frees and coalesces every block on the quick lists of arena a
+ */
+static void consolidate(arena_t *a)
+{
+    char *bp;
+    int i;
+
+    STAT_ADD(a, consolidations, 1);
+    for (i = 0; i < QUICK_BINS; i++) {
+        while ((bp = a->quick[i]) != NULL) {                                    // take the block off its list before free_block overwrites the link
+            a->quick[i] = NEXT_CACHED(bp);
+            a->quick_blocks--;
+            free_block(a, bp);
+        }
+    }
+}
+
+/*
+ * resizes block or slot ptr of arena a to hold size bytes, in place if possible
+ */
+static void *arena_realloc(arena_t *a, void *ptr, size_t size)
+{
+    size_t asize, oldsize, csize;
+    slab_t *s;
+    char *next;
+    void *newptr;
+
+    if ((s = slab_of(a, ptr)) != NULL) {                                        // a slot keeps its size, it moves if it gets too small
+        if (size <= s->size)
+            return ptr;
+        if ((newptr = arena_malloc(a, size)) == NULL)
+            return NULL;
+        memcpy(newptr, ptr, s->size);
+        slab_free(a, s, ptr);
+        return newptr;
+    }
+
+    asize = adjust_size(size);
+    oldsize = GET_SIZE(HDRP(ptr));
+    if (asize <= oldsize) {                                                     // shrinking: split off the tail if it is big enough
+        resize_block(a, ptr, oldsize, asize);
+        return ptr;
+    }
+
+    next = NEXT_BLKP(ptr);
+    csize = oldsize;
+    if (!GET_ALLOC(HDRP(next)))                                                 // a free next block can be absorbed
+        csize += GET_SIZE(HDRP(next));
+    if (csize >= asize) {                                                       // the block and its free neighbour are big enough
+        remove_freeblock(a, next);
+        resize_block(a, ptr, csize, asize);
+        use_block(a, ptr);
+        return ptr;
+    }
+
+    if ((HDRP(next) == a->epilogue ||                                           // the block or its free neighbour ends the heap,
+         (csize != oldsize && HDRP(NEXT_BLKP(next)) == a->epilogue)) &&
+        (long)heap_sbrk(a, asize - csize) != -1) {                              // so grow the heap by the missing bytes only, if it can
+        if (csize != oldsize)
+            remove_freeblock(a, next);
+        PUT(HDRP(ptr), PACK(asize, 1 | GET_PREV_ALLOC(HDRP(ptr))));             // the block now reaches up to the new end of the heap
+        a->epilogue = HDRP(NEXT_BLKP(ptr));
+        PUT(a->epilogue, PACK(0, 1 | PREV_ALLOC));                              // move the epilogue behind it
+        use_block(a, ptr);
+        return ptr;
+    }
+
+    newptr = fit_or_consolidate(a, asize);                                      // last resort, also when the heap can't grow: move the payload
+    if (newptr != NULL && HDRP(NEXT_BLKP(newptr)) != a->epilogue)               // a hole inside the heap is used as usual,
+        place(a, newptr, asize);
+    else if ((newptr = alloc_at_tail(a, asize)) == NULL)                        // otherwise the block moves to the end of the heap where it can keep growing
+        return NULL;
+    memcpy(newptr, ptr, oldsize - WSIZE);                                       // the old payload is smaller than size, copy all of it
+    free_block(a, ptr);
+    return newptr;
+}
+
+/*
+ * returns the slab that slot bp belongs to, or NULL if bp is a block of the heap. A slab covers its whole page,
+ * so the page map tells them apart. mm_free calls this without the lock, the bit of a live block's page can't change.
+ */
+static slab_t *slab_of(arena_t *a, void *bp)
+{
+    size_t page = ((char *)bp - a->slab_base) / SLAB_SIZE;
+
+    if (!(__atomic_load_n(&a->slab_map[page / 32], __ATOMIC_RELAXED) & (1u << (page % 32))))
+        return NULL;
+    return (slab_t *)(a->slab_base + page * SLAB_SIZE);
+}
+
+/*
+ * hands out a free slot of a slab of the class, a new slab is created if the class has none with free slots
+ */
+static void *slab_alloc(arena_t *a, int class)
+{
+    slab_t *s = a->slabs[class];
+    int i, slot;
+
+    if (s == NULL && (s = slab_create(a, class)) == NULL)
+        return NULL;
+    for (i = 0; s->free_map[i] == 0; i++)                                       // a slab on the list has a free slot
+        ;
+    slot = 32 * i + __builtin_ctz(s->free_map[i]);
+    s->free_map[i] &= ~(1u << (slot % 32));
+    if (--s->nfree == 0)                                                        // full slabs leave the list of their class
+        slab_unlink(a, s);
+    return (char *)s + SLAB_FIRST + slot * s->size;
+}
+
+/*
+ * gives slot bp back to slab s, an empty slab goes back to the heap unless it is the only one of its class with free slots
+ */
+static void slab_free(arena_t *a, slab_t *s, void *bp)
+{
+    int slot = ((char *)bp - (char *)s - SLAB_FIRST) / s->size;
+    size_t page;
+
+    s->free_map[slot / 32] |= 1u << (slot % 32);
+    if (s->nfree++ == 0)                                                        // the slab has a free slot again
+        slab_link(a, s);
+    if (s->nfree < s->nslots || (a->slabs[s->class] == s && s->next == NULL))
+        return;
+
+    slab_unlink(a, s);
+    page = ((char *)s - a->slab_base) / SLAB_SIZE;
+    __atomic_fetch_and(&a->slab_map[page / 32], ~(1u << (page % 32)), __ATOMIC_RELAXED);
+    STAT_SUB(a, slabs, 1);
+    free_block(a, s);
+}
+
+/*
+ * carves a new slab for the class from the heap and puts it on the list of the class
+ */
+static slab_t *slab_create(arena_t *a, int class)
+{
+    slab_t *s;
+    size_t page;
+    unsigned int i;
+
+    if ((s = alloc_aligned(a, SLAB_SIZE, SLAB_SIZE)) == NULL)
+        return NULL;
+    s->class = class;
+    s->size = (class + 1) * ALIGNMENT;
+    s->nslots = (SLAB_SIZE - WSIZE - SLAB_FIRST) / s->size;                     // the slots must not leave the page, the block may be a little larger
+    s->nfree = s->nslots;
+    memset(s->free_map, 0, sizeof(s->free_map));
+    for (i = 0; i < s->nslots; i++)
+        s->free_map[i / 32] |= 1u << (i % 32);
+
+    page = ((char *)s - a->slab_base) / SLAB_SIZE;
+    __atomic_fetch_or(&a->slab_map[page / 32], 1u << (page % 32), __ATOMIC_RELAXED);
+    s->next = s->prev = NULL;
+    slab_link(a, s);
+    STAT_ADD(a, slabs, 1);
+    return s;
+}
+
+/*
+ * adds slab s to the front of the list of its class
+ */
+static void slab_link(arena_t *a, slab_t *s)
+{
+    s->prev = NULL;
+    s->next = a->slabs[s->class];
+    if (s->next != NULL)
+        s->next->prev = s;
+    a->slabs[s->class] = s;
+}
+
+/*
+ * removes slab s from the list of its class
+ */
+static void slab_unlink(arena_t *a, slab_t *s)
+{
+    if (s->prev != NULL)
+        s->prev->next = s->next;
+    else
+        a->slabs[s->class] = s->next;
+    if (s->next != NULL)
+        s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+}
 
 /*
- * initializes the allocator
+ * allocates a block of asize bytes whose payload is aligned to align bytes, a power of two above ALIGNMENT.
+ * If no free block has room for it, the heap is extended by enough bytes to find an aligned spot in the new free block.
  */
-int mm_init(void)
+static void *alloc_aligned(arena_t *a, size_t asize, size_t align)
 {
+    void *bp;
 
-    if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1)                         // create the initial empty heap
-        return -1;
-    PUT(heap_listp, 0);                                                         // alignment padding
-    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1));                                // set the prologue header
-    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1));                                // set the prologue footer
-    PUT(heap_listp + (3*WSIZE), PACK(0, 1));                                    // set the epilogue header
-    epilogue = (heap_listp + (3*WSIZE));                                        // needed for heap checker
-    heap_listp += (2*WSIZE);
-    free_listp = NULL;                                                          // initialize the freelist to be empty
-
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL)                                   // extend the empty heap with a free block of CHUNKSIZE bytes
-        return -1;
-    return 0;
+    if ((bp = aligned_fit(a, asize, align)) != NULL)
+        return bp;
+    if (a->quick_blocks != 0) {                                                 // coalescing the deferred blocks may make room
+        consolidate(a);
+        if ((bp = aligned_fit(a, asize, align)) != NULL)
+            return bp;
+    }
+    if (extend_heap(a, (asize + align + MINIMUM) / WSIZE) == NULL)
+        return NULL;
+    return aligned_fit(a, asize, align);
 }
 
 /*
- * allocates a block on the heap
+ * looks for the first free block that has room for an aligned block of asize bytes and places it there: the bytes in
+ * front of the aligned payload become a free block of their own, and so do the bytes behind the block if there are
+ * enough of them
  */
-void *mm_malloc(size_t size)
+static void *aligned_fit(arena_t *a, size_t asize, size_t align)
 {
-    size_t asize;
-    size_t extendsize;
-    char *bp;
+    unsigned int mask = a->seg_mask & ~((1u << size_class(asize)) - 1);         // smaller classes can't have room
+    size_t size, front, rest, prev_alloc;
+    char *bp = NULL, *p = NULL;
 
-    if (size == 0)                                                              // if the block's size is 0 do nothing
+    for (; mask != 0 && p == NULL; mask &= mask - 1) {                          // the class lists first
+        for (bp = a->seg_lists[__builtin_ctz(mask)]; bp != NULL; bp = NEXT_FREE(bp))
+            if ((p = aligned_spot(bp, asize, align)) != NULL)
+                break;
+    }
+    if (p == NULL) {                                                            // then the tree, from the smallest block that may fit upwards
+        for (bp = tree_best_fit(a, asize); bp != NULL; bp = tree_successor(a, bp))
+            if ((p = aligned_spot(bp, asize, align)) != NULL)
+                break;
+    }
+    if (p == NULL)
         return NULL;
 
-    if (size <= DSIZE)                                                          // if the size is less than the minimum block size,
-        asize = MINIMUM;                                                        // set it to minimum
-    else                                                                        // align the size to be a multiple of 8
-        asize = DSIZE * ((size + DSIZE + (DSIZE - 1))/ DSIZE);
-
-    if ((bp = find_fit(asize)) != NULL){                                        // search for a fit and places the block if one is found
-        place(bp, asize);
-        return bp;
+    size = GET_SIZE(HDRP(bp));
+    front = p - bp;
+    remove_freeblock(a, bp);
+    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    if (front != 0) {                                                           // the front stays free
+        PUT(HDRP(bp), PACK(front, prev_alloc));
+        PUT(FTRP(bp), PACK(front, 0));
+        add_freeblock(a, bp);
+        prev_alloc = 0;
     }
-    extendsize = MAX(asize, CHUNKSIZE);                                         // set the number of bytes to extend the heap to the maximum of asize and CHUNKSIZE
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)                           // if no fit was found the heap needs to be extended
-        return NULL;
-    place(bp, asize);
-    return bp;
+    rest = size - front - asize;
+    if (rest >= MINIMUM) {                                                      // so does the rest behind the block
+        PUT(HDRP(p), PACK(asize, 1 | prev_alloc));
+        bp = NEXT_BLKP(p);
+        PUT(HDRP(bp), PACK(rest, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(rest, 0));
+        add_freeblock(a, bp);
+    }
+    else {                                                                      // or the block takes it
+        PUT(HDRP(p), PACK(asize + rest, 1 | prev_alloc));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(p)));
+    }
+    use_block(a, p);
+    return p;
 }
 
 /*
- * remove the block from the malloc list and free the place
+ * returns where in free block bp an aligned block of asize bytes can start, or NULL if it doesn't fit. The bytes in front of
+ * it become a free block of their own, so there have to be either none or at least MINIMUM of them.
  */
-void mm_free(void *ptr)
+static char *aligned_spot(char *bp, size_t asize, size_t align)
 {
-    if(ptr == NULL || heap_listp == NULL)                                      // if freeing nothing or if heap isn't initialized yet, return
-        return;
+    char *p = bp;
 
-    size_t size = GET_SIZE(HDRP(ptr));                                         // get size of the block
-    PUT(HDRP(ptr), PACK(size, 0));                                             // set size of the block in header must be 0
-    PUT(FTRP(ptr), PACK(size, 0));                                             // set size of the block in footer must be 0
-    coalesce(ptr);                                                             // coalesce the block, if needed
+    if ((uintptr_t)p % align != 0)
+        p = (char *)(((uintptr_t)bp + MINIMUM + align - 1) & ~(uintptr_t)(align - 1));
+    return (p - bp + asize <= GET_SIZE(HDRP(bp))) ? p : NULL;
 }
 
+/*
+ * returns the block size needed for a payload of size bytes: the header is added and the result aligned to ALIGNMENT, at least MINIMUM
+ */
+static size_t adjust_size(size_t size){
+    if (size <= MINIMUM - WSIZE)                                                // if the size is less than the minimum block size,
+        return MINIMUM;                                                         // set it to minimum
+    return ALIGN(size + WSIZE);                                                 // add the header and align the size to be a multiple of ALIGNMENT
+}
 
 /*
- * Implemented simply in terms of mm_malloc and mm_free
+ * finds a fitting block for asize bytes: searches the request's own class with the placement policy, otherwise the next non-empty class
  */
-void *mm_realloc(void *ptr, size_t size){
-    /*
-     * ATTENTION: You do not need to implement realloc for this assignment
-     */
-    void *oldptr = ptr;
-    void *newptr;
-    size_t copySize;
-    newptr = mm_malloc(size);
-    if (newptr == NULL)
-        return NULL;
-    copySize = *(size_t *)((char *)oldptr - SIZE_T_SIZE);
-    if (size < copySize)
-        copySize = size;
-    memcpy(newptr, oldptr, copySize);
-    mm_free(oldptr);
-    return newptr;
+static void *find_fit(arena_t *a, size_t asize){
+    int class = size_class(asize);                                              // class that may hold blocks of asize bytes
+    unsigned int larger;
+    void *bp;
+
+    if (asize >= TREE_MIN)                                                      // large requests are always a best fit from the tree
+        return tree_best_fit(a, asize);
+
+    if (policy == MM_NEXT_FIT)                                                  // search the request's class, it may hold blocks that are too small
+        bp = next_fit(a, class, asize);
+    else
+        bp = fit_in_list(a, a->seg_lists[class], asize);
+    if (bp != NULL)
+        return bp;
+
+    if (class == NUM_CLASSES - 1)                                               // there is no larger class to look at
+        return tree_best_fit(a, asize);
+    larger = a->seg_mask & ~((2u << class) - 1);                                // non-empty classes above the request's class
+    if (larger == 0)                                                            // if there is none the tree is left
+        return tree_best_fit(a, asize);
+    class = __builtin_ctz(larger);
+    if (policy == MM_FIRST_FIT)                                                 // every block of a larger class fits, take the head
+        return a->seg_lists[class];
+    if (policy == MM_NEXT_FIT)
+        return a->rovers[class] ? a->rovers[class] : a->seg_lists[class];
+    return fit_in_list(a, a->seg_lists[class], asize);                          // good and best fit still look for the smallest one
 }
 
 /*
- * finds a fitting block for asize bytes using first fit search
+ * walks the free list starting at bp and returns the smallest of the first fit_limit blocks that fit asize bytes
  */
-static void *find_fit(size_t asize){
-    void *bp = free_listp;                                                      // point to the beginning of the freelist
-    for(; bp != NULL; bp = (char *) NEXT_FREE(bp)) {                            // iterate through freelist until it finds a block that fits a size
-        if(asize <= GET_SIZE(HDRP(bp)))
-            return bp;
+static void *fit_in_list(arena_t *a, char *bp, size_t asize){
+    char *best = NULL;
+    size_t best_size = 0;
+    size_t size;
+    int fits = 0;
+
+    for(; bp != NULL; bp = NEXT_FREE(bp)) {                                     // iterate through the list
+        STAT_ADD(a, fit_steps, 1);
+        size = GET_SIZE(HDRP(bp));
+        if (asize > size)                                                       // skip blocks that are too small
+            continue;
+        if (best == NULL || size < best_size) {                                 // remember the smallest candidate so far
+            best = bp;
+            best_size = size;
+        }
+        if (size == asize || ++fits == fit_limit)                               // an exact fit can't be beaten, otherwise stop after fit_limit candidates
+            break;
+    }
+    return best;
+}
+
+/*
+ * first fit search of a class that starts at the roving pointer of the class and wraps around to its head
+ */
+static void *next_fit(arena_t *a, int class, size_t asize){
+    char *start = a->rovers[class] ? a->rovers[class] : a->seg_lists[class];
+    char *bp;
+
+    for (bp = start; bp != NULL; bp = NEXT_FREE(bp)) {                          // from the rover to the end of the list
+        STAT_ADD(a, fit_steps, 1);
+        if (asize <= GET_SIZE(HDRP(bp)))
+            break;
+    }
+    if (bp == NULL) {                                                           // from the head of the list back to the rover
+        for (bp = a->seg_lists[class]; bp != start; bp = NEXT_FREE(bp)) {
+            STAT_ADD(a, fit_steps, 1);
+            if (asize <= GET_SIZE(HDRP(bp)))
+                break;
+        }
+        if (bp == start)
+            bp = NULL;
     }
-    return NULL;                                                                // if there is no fit it return NULL
+    if (bp != NULL)
+        a->rovers[class] = NEXT_FREE(bp);                                       // the next search continues after the block we hand out
+    return bp;
+}
+
+/*
+ * returns the index of the free list class that stores blocks of size bytes
+ */
+static int size_class(size_t size){
+    int class = (31 - __builtin_clz((unsigned int) size)) - 4;                 // floor(log2(size)) - log2(MINIMUM)
+    if (class < 0)
+        return 0;
+    if (class >= NUM_CLASSES)
+        return NUM_CLASSES - 1;
+    return class;
 }
 
 /*
 * extends the heap by adding a free block to the end of size bytes
 */
-static void *extend_heap(size_t words){
-    char *bp;
+static void *extend_heap(arena_t *a, size_t words){
+    char *bp, *old;
     size_t size;                                                                // make sure the block will be aligned
-    size = (words % 2) ? (words+1) * WSIZE: words * WSIZE;                      // calculate the number of bytes that have to be added to the heap
-    if ((long)(bp = mem_sbrk(size)) == -1)
+    size = ALIGN(words * WSIZE);                                                // calculate the number of bytes that have to be added to the heap
+    if ((long)(bp = heap_sbrk(a, size)) == -1)
         return NULL;
 
-    PUT(HDRP(bp), PACK(size, 0));                                               // initialize the header and footer of the new block
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));                        // initialize the header and footer of the new block, the old epilogue knows about the previous block
     PUT(FTRP(bp), PACK(size, 0));
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0,1));                                        // set the block after the new block the be the epilogue block
+    a->epilogue = HDRP(NEXT_BLKP(bp));
+
+    old = HDRP(bp);                                                             // the header took the place of the old epilogue
+    bp = coalesce(a, bp);                                                       // try coalescing
+    if (bp < old) {                                                             // merged with the free block before, its footer and the new header are inside now,
+        PUT(old - WSIZE, 0);                                                    // clear them so fresh memory stays zero
+        PUT(old, 0);
+    }
+    return bp;
+}
+
+/*
+ * returns by how many bytes to extend the heap for a request of asize bytes that found no fit, so that the free block at
+ * the end of the heap holds the larger of asize and the growth step afterwards. A free block that already ends the heap
+ * counts towards that, the heap grows only by what is missing. The growth step adapts to how fast extensions get used up.
+ */
+static size_t grow_size(arena_t *a, size_t asize){
+    unsigned int requests = a->requests - a->grow_requests;                     // requests since the last extension
+    size_t size, tail = 0;
+
+    if (requests >= GROW_STORM)
+        a->fast_grows = 0;
+    else if (++a->fast_grows >= GROW_RUN)                                       // the heap keeps filling up fast, grow in larger steps
+        a->grow_step = MIN(a->grow_step * 2, GROW_MAX);
+    if (requests > GROW_CALM)                                                   // extensions last long, go back towards CHUNKSIZE
+        a->grow_step = MAX(a->grow_step / 2, CHUNKSIZE);
+    a->grow_requests = a->requests;
+
+    if (!GET_PREV_ALLOC(a->epilogue))                                           // the heap ends with a free block, its footer is right before the epilogue
+        tail = GET_SIZE(a->epilogue - WSIZE);
+    size = MAX(asize, a->grow_step);
+    return (tail < size) ? size - tail : a->grow_step;
+}
+
+/*
+ * grows the heap of arena a by size bytes with mem_region_sbrk and counts the extension
+ */
+static void *heap_sbrk(arena_t *a, size_t size){
+    char *clean = mem_region_clean(a->region);
+    char *p = mem_region_sbrk(a->region, size);
 
-    return coalesce(bp);                                                        // try coalescing
+    if (p != (void *)-1) {
+        STAT_ADD(a, heap_grows, 1);
+        STAT_ADD(a, heap_grow_bytes, size);
+        if (p < clean)                                                          // the new memory was part of an earlier or trimmed heap
+            a->fresh = MAX(a->fresh, clean);
+    }
+    return p;
 }
 
 /*
- * places asize bytes in a block and splits the block if it can still store at least 16 bytes
+ * places asize bytes in a block and splits the block if it can still store at least MINIMUM bytes
  */
-static void place(void *bp, size_t asize){
+static void place(arena_t *a, void *bp, size_t asize){
     size_t csize = GET_SIZE(HDRP(bp));                                          // size of block where asize bytes are placed
     if ((csize-asize) >= MINIMUM) {                                             // if the current block's size can still at least store MIMIMUM bytes the block is split
-        remove_freeblock(bp);                                                   // remove the block from freelist
-        PUT(HDRP(bp), PACK(asize, 1));                                          // set size in block's header to asize and allocation bit to 1
-        PUT(FTRP(bp), PACK(asize, 1));                                          // set size in block's footer to asize and allocation bit to 1
+        STAT_ADD(a, splits, 1);
+        remove_freeblock(a, bp);                                                // remove the block from freelist
+        PUT(HDRP(bp), PACK(asize, 1 | GET_PREV_ALLOC(HDRP(bp))));               // set size in block's header to asize and allocation bit to 1, allocated blocks have no footer
+        use_block(a, bp);
         bp = NEXT_BLKP(bp);                                                     // set pointer to next block
-        PUT(HDRP(bp), PACK(csize - asize, 0));                                  // set size in next block's header to the remaining bits and allocation bit to 0
+        PUT(HDRP(bp), PACK(csize - asize, PREV_ALLOC));                         // set size in next block's header to the remaining bits and allocation bit to 0
         PUT(FTRP(bp), PACK(csize - asize, 0));                                  // set size in next block's footer to the remaining bits and allocation bit to 0
-        add_freeblock(bp);                                                      // add the free block to the freelist
+        add_freeblock(a, bp);                                                   // add the free block to the freelist
     }
     else{                                                                       // if the block isn't large enough to be split use the whole block
-        PUT(HDRP(bp), PACK(csize,1));                                           // set size in block's header to csize and allocation bit to 1
-        PUT(FTRP(bp), PACK(csize,1));                                           // set size in block's header to csize and allocation bit to 1
-        remove_freeblock(bp);                                                   // remove the block from free list
+        remove_freeblock(a, bp);                                                // remove the block from free list
+        PUT(HDRP(bp), PACK(csize, 1 | GET_PREV_ALLOC(HDRP(bp))));               // set size in block's header to csize and allocation bit to 1
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));                                    // tell the next block that this one is allocated
+        use_block(a, bp);
+    }
+}
+
+/*
+ * notes that block bp is handed out. The fresh memory of the heap starts behind it at the earliest, whether bp itself
+ * was fresh is kept in a->fresh_block: mm_calloc needs to clear only the words the free block's links and footer used.
+ */
+static void use_block(arena_t *a, char *bp){
+    a->fresh_block = (bp >= a->fresh);
+    if (NEXT_BLKP(bp) > a->fresh)
+        a->fresh = NEXT_BLKP(bp);
+}
+
+/*
+ * allocates a block of asize bytes that ends right before the epilogue, using the free block at the end of the heap and mem_sbrk for the rest
+ */
+static void *alloc_at_tail(arena_t *a, size_t asize){
+    char *last = a->epilogue + WSIZE;                                           // a block starting at the epilogue if the heap doesn't end with a free block
+    size_t prev_alloc = GET_PREV_ALLOC(a->epilogue);
+    size_t tsize = 0;
+    char *bp;
+
+    if (!prev_alloc) {                                                          // the heap ends with a free block, use its top end
+        last = PREV_BLKP(last);
+        tsize = GET_SIZE(HDRP(last));
+        prev_alloc = GET_PREV_ALLOC(HDRP(last));
+        remove_freeblock(a, last);
+    }
+    if (tsize < asize) {                                                        // grow the heap by the missing bytes
+        if ((long)heap_sbrk(a, asize - tsize) == -1) {
+            if (tsize != 0)
+                add_freeblock(a, last);                                         // give the free block back, the heap is unchanged
+            return NULL;
+        }
+        tsize = asize;
+    }
+
+    if ((tsize - asize) >= MINIMUM) {                                           // the lower part stays free
+        PUT(HDRP(last), PACK(tsize - asize, prev_alloc));
+        PUT(FTRP(last), PACK(tsize - asize, 0));
+        add_freeblock(a, last);
+        bp = NEXT_BLKP(last);
+        PUT(HDRP(bp), PACK(asize, 1));                                          // the block before is free
+    }
+    else {                                                                      // too small to split, use all of it
+        bp = last;
+        PUT(HDRP(bp), PACK(tsize, 1 | prev_alloc));
+    }
+    a->epilogue = HDRP(NEXT_BLKP(bp));                                          // move the epilogue behind the block
+    PUT(a->epilogue, PACK(0, 1 | PREV_ALLOC));
+    use_block(a, bp);
+    return bp;
+}
+
+/*
+ * shrinks the allocated block bp that currently spans csize bytes to asize bytes, the tail becomes a free block if it is big enough
+ */
+static void resize_block(arena_t *a, void *bp, size_t csize, size_t asize){
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    char *rest;
+
+    if ((csize - asize) >= MINIMUM) {                                           // the tail can store a block of its own
+        PUT(HDRP(bp), PACK(asize, 1 | prev_alloc));
+        rest = NEXT_BLKP(bp);
+        PUT(HDRP(rest), PACK(csize - asize, PREV_ALLOC));                       // turn the tail into a free block
+        PUT(FTRP(rest), PACK(csize - asize, 0));
+        CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(rest)));
+        trim_heap(a, coalesce(a, rest));                                        // the block after the tail may be free as well
+    }
+    else {                                                                      // otherwise the block keeps all csize bytes
+        PUT(HDRP(bp), PACK(csize, 1 | prev_alloc));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    }
+}
+
+/*
+ * gives the top of the free block bp back to memlib if bp ends the heap and is larger than the trim threshold,
+ * a free block of trim_pad bytes is left so the next allocations don't have to extend the heap right away
+ */
+static void trim_heap(arena_t *a, void *bp){
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    if (trim_threshold == 0 || size <= trim_threshold || HDRP(NEXT_BLKP(bp)) != a->epilogue)
+        return;
+
+    remove_freeblock(a, bp);
+    if (trim_pad != 0) {                                                        // keep the lower trim_pad bytes as a free block
+        PUT(HDRP(bp), PACK(trim_pad, prev_alloc));
+        PUT(FTRP(bp), PACK(trim_pad, 0));
+        add_freeblock(a, bp);
+        a->epilogue = HDRP(NEXT_BLKP(bp));
+        PUT(a->epilogue, PACK(0, 1));                                           // the block before the new epilogue is free
+    }
+    else {                                                                      // or the epilogue takes the place of the whole block
+        a->epilogue = HDRP(bp);
+        PUT(a->epilogue, PACK(0, 1 | prev_alloc));
     }
+    mem_region_trim(a->region, size - trim_pad);
+    STAT_ADD(a, heap_trims, 1);
+    STAT_ADD(a, heap_trim_bytes, size - trim_pad);
 }
 
 /*
  * checks if the adjacent blocks are also free and coalesces them
  */
-static void *coalesce(void *bp)
+static void *coalesce(arena_t *a, void *bp)
 {
-    size_t prev_alloc = GET_ALLOC(HDRP(PREV_BLKP(bp)));                         // store allocation bit of previous block
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));                               // store allocation bit of previous block, only free blocks have a footer to find them
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));                         // store allocation bit of next block
     size_t size = GET_SIZE(HDRP(bp));                                           // store size of current block
 
+    STAT_ADD(a, coalesces[(!prev_alloc << 1) | !next_alloc], 1);                // count the case: none, next, previous or both free
     if (prev_alloc && next_alloc) {                                             // if the next and previous block are allocated, no coalescing possible
-        add_freeblock(bp);                                                      // add block to freelist
+        add_freeblock(a, bp);                                                   // add block to freelist
         return bp;
     }
 
     else if (prev_alloc && !next_alloc) {                                       // if the next block is free and previous is allocated coalesce current and next block
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));                                  // set size of new block to size of next + size of current block
-        remove_freeblock(NEXT_BLKP(bp));                                        // remove next block from freelist, since it won't exist anymore
-        PUT(HDRP(bp), PACK(size, 0));                                           // set new size in block's header
+        remove_freeblock(a, NEXT_BLKP(bp));                                     // remove next block from freelist, since it won't exist anymore
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));                                  // set new size in block's header
         PUT(FTRP(bp), PACK(size,0));                                            // set new size in block's footer
-        add_freeblock(bp);                                                      // add new block to the freelist
+        add_freeblock(a, bp);                                                   // add new block to the freelist
     }
 
     else if (!prev_alloc && next_alloc) {                                       // if previous block is free and next is allocated
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));                                  // set size of new block to size of previous + size of current block
-        remove_freeblock(PREV_BLKP(bp));                                        // remove previous block from freelist, since it won't exist anymore
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));                                // set new size in previous block's header
+        remove_freeblock(a, PREV_BLKP(bp));                                     // remove previous block from freelist, since it won't exist anymore
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));                       // set new size in previous block's header, blocks before a free block are allocated
         PUT(FTRP(bp), PACK(size, 0));                                           // set new size in footer
         bp = PREV_BLKP(bp);                                                     // set the block pointer to the previous block since this is the new beginning of the block
-        add_freeblock(bp);                                                      // add new block to the freelist
+        add_freeblock(a, bp);                                                   // add new block to the freelist
     }
 
     else {                                                                      // if both adjacent blocks are free
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));  // set size of new block to size of previous + size of current + size of next block
-        remove_freeblock(PREV_BLKP(bp));                                        // remove previous block from freelist
-        remove_freeblock(NEXT_BLKP(bp));                                        // remove next block from freelist
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));                                // set new size in previous block's header
+        remove_freeblock(a, PREV_BLKP(bp));                                     // remove previous block from freelist
+        remove_freeblock(a, NEXT_BLKP(bp));                                     // remove next block from freelist
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));                       // set new size in previous block's header
         PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));                                // set new size in next block's header
         bp = PREV_BLKP(bp);                                                     // set the block pointer to the previous block since this is the new beginning of the block
-        add_freeblock(bp);                                                      // add new block to the freelist
+        add_freeblock(a, bp);                                                   // add new block to the freelist
     }
 
-    //mm_check();
-
+    DEBUG_BLOCK(a, bp);                                                         // the merged block and its neighbours
     return bp;
 }
 
 /*
- * adds a new free block to the beginning of the freelist
+ * adds a new free block to the beginning of the free list of its size class, or to the tree if it is large
  */
-static void add_freeblock(void *bp){
+static void add_freeblock(arena_t *a, void *bp){
+    int class = size_class(GET_SIZE(HDRP(bp)));                                 // pick the list by the size of the block
+    char *head = a->seg_lists[class];
 
-    if (free_listp == NULL){                                                    // if the list is empty,
-        free_listp = bp;                                                        // set bp to be the first element of the list
-        PUT(bp, 0);                                                             // set previous of block to 0
-        PUT(bp+WSIZE, 0);                                                       // set next of block to 0
+    STAT_ADD(a, free_blocks, 1);
+    STAT_ADD(a, free_bytes, GET_SIZE(HDRP(bp)));
+    if (GET_SIZE(HDRP(bp)) >= TREE_MIN) {                                       // large blocks go to the tree instead
+        tree_insert(a, bp);
+        DEBUG_NODE(a, bp);
+        return;
     }
-    else {
-        PUT(((char *) free_listp), (int) bp);                                   // set the current head of the list's previous to bp
-        PUT(bp, 0);                                                             // set bp's previous to 0
-        PUT(bp + WSIZE, (int) free_listp);                                      // set bp's next to the head of the list
-        free_listp = bp;                                                        // set the head of the list to bp
+
+    SET_PREV_FREE(bp, 0);                                                       // set bp's previous to 0
+    SET_NEXT_FREE(bp, head);                                                    // set bp's next to the head of the list
+    if (head != NULL)                                                           // if the list isn't empty,
+        SET_PREV_FREE(head, bp);                                                // set the current head of the list's previous to bp
+    a->seg_lists[class] = bp;                                                   // set the head of the list to bp
+    a->seg_mask |= (1u << class);                                               // the class is not empty anymore
+    DEBUG_NODE(a, bp);
+}
+
+/*
+ * removes free block from its free list by adjusting the pointers to the previous and next blocks of the removed one,
+ * or from the tree if it is large. The header of the block still has to hold the size it was added with.
+ */
+static void remove_freeblock(arena_t *a, void *bp){
+    int class = size_class(GET_SIZE(HDRP(bp)));                                 // the list the block was added to
+    char *prev = PREV_FREE(bp);
+    char *next = NEXT_FREE(bp);
+
+    DEBUG_NODE(a, bp);                                                          // the links we are about to follow
+    STAT_SUB(a, free_blocks, 1);
+    STAT_SUB(a, free_bytes, GET_SIZE(HDRP(bp)));
+    if (GET_SIZE(HDRP(bp)) >= TREE_MIN) {                                       // the block is in the tree
+        tree_remove(a, bp);
+        return;
     }
+
+    if (a->rovers[class] == bp)                                                 // don't let the roving pointer point to a block that isn't free
+        a->rovers[class] = next;
+    if (prev == NULL)                                                           // if the block doesn't have a previous block it is the first one in the list
+        a->seg_lists[class] = next;                                             // set beginning of the list to next block
+    else
+        SET_NEXT_FREE(prev, next);                                              // set previous block's next to point to bp's next
+    if (next != NULL)                                                           // if the block has a next block
+        SET_PREV_FREE(next, prev);                                              // set next blocks's previous to previous block
+    if (a->seg_lists[class] == NULL)                                            // if the list became empty clear its bit
+        a->seg_mask &= ~(1u << class);
+}
+
+/*
+ * top-down splay of the tree rooted at t: the node with the key of size and bp, or the node just before or after
+ * that key if there isn't one, becomes the root. Returns the new root.
+ */
+static char *tree_splay(char *t, size_t size, char *bp)
+{
+    char *links[2];                                                             // holds the left and right trees while we go down
+    char *node = (char *)links;
+    char *l = node, *r = node, *y;
+
+    if (t == NULL)
+        return NULL;
+    SET_LEFT_CHILD(node, NULL);
+    SET_RIGHT_CHILD(node, NULL);
+    for (;;) {
+        if (KEY_LESS(size, bp, GET_SIZE(HDRP(t)), t)) {                         // the key is on the left
+            if ((y = LEFT_CHILD(t)) == NULL)
+                break;
+            if (KEY_LESS(size, bp, GET_SIZE(HDRP(y)), y)) {                     // zig-zig: rotate right first
+                SET_LEFT_CHILD(t, RIGHT_CHILD(y));
+                SET_RIGHT_CHILD(y, t);
+                t = y;
+                if (LEFT_CHILD(t) == NULL)
+                    break;
+            }
+            SET_LEFT_CHILD(r, t);                                               // t and its right subtree go to the right tree
+            r = t;
+            t = LEFT_CHILD(t);
+        }
+        else if (KEY_LESS(GET_SIZE(HDRP(t)), t, size, bp)) {                    // the key is on the right
+            if ((y = RIGHT_CHILD(t)) == NULL)
+                break;
+            if (KEY_LESS(GET_SIZE(HDRP(y)), y, size, bp)) {                     // zag-zag: rotate left first
+                SET_RIGHT_CHILD(t, LEFT_CHILD(y));
+                SET_LEFT_CHILD(y, t);
+                t = y;
+                if (RIGHT_CHILD(t) == NULL)
+                    break;
+            }
+            SET_RIGHT_CHILD(l, t);                                              // t and its left subtree go to the left tree
+            l = t;
+            t = RIGHT_CHILD(t);
+        }
+        else
+            break;
+    }
+    SET_RIGHT_CHILD(l, LEFT_CHILD(t));                                          // put the left and right trees back together under t
+    SET_LEFT_CHILD(r, RIGHT_CHILD(t));
+    SET_LEFT_CHILD(t, RIGHT_CHILD(node));
+    SET_RIGHT_CHILD(t, LEFT_CHILD(node));
+    return t;
 }
 
 /*
- * removes free block from the freelist by adjusting the pointers to the previous and next blocks of the removed one
+ * adds free block bp to the tree as its new root
  */
-static void remove_freeblock(void *bp){
+static void tree_insert(arena_t *a, char *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *t;
 
-    if ((PREV_FREE(bp) == 0) && (NEXT_FREE(bp) == 0)){                          // if the block doesn't have a previous or next block it means that it is the only one in the freelist
-        free_listp = 0;
+    if (a->tree == NULL) {
+        SET_LEFT_CHILD(bp, NULL);
+        SET_RIGHT_CHILD(bp, NULL);
+        a->tree = bp;
+        return;
+    }
+    t = tree_splay(a->tree, size, bp);                                          // the neighbour of bp's key becomes the root
+    if (KEY_LESS(size, bp, GET_SIZE(HDRP(t)), t)) {
+        SET_LEFT_CHILD(bp, LEFT_CHILD(t));
+        SET_RIGHT_CHILD(bp, t);
+        SET_LEFT_CHILD(t, NULL);
     }
-    else if (PREV_FREE(bp) == 0 && NEXT_FREE(bp) != 0){                         // if the block has a next but not a previous block it means that it is the first one in the list
-        free_listp = (char *)NEXT_FREE(bp);                                     // set beginning of the list to next block
-        PUT((char *) NEXT_FREE(bp), 0);                                         // set next block's previous to 0
+    else {
+        SET_RIGHT_CHILD(bp, RIGHT_CHILD(t));
+        SET_LEFT_CHILD(bp, t);
+        SET_RIGHT_CHILD(t, NULL);
     }
-    else if (PREV_FREE(bp) != 0 && NEXT_FREE(bp) == 0){                         // if the block has a previous but not a next block it means that it is the last one in the list
-        PUT(((char *)PREV_FREE(bp) + WSIZE), 0);                                // set the previous block's next to 0
+    a->tree = bp;
+}
+
+/*
+ * removes free block bp from the tree
+ */
+static void tree_remove(arena_t *a, char *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *t = tree_splay(a->tree, size, bp);                                    // bp is in the tree, so it becomes the root
+
+    if (LEFT_CHILD(t) == NULL)
+        a->tree = RIGHT_CHILD(t);
+    else {                                                                      // the largest block on the left takes its place, it has no right child
+        a->tree = tree_splay(LEFT_CHILD(t), size, bp);
+        SET_RIGHT_CHILD(a->tree, RIGHT_CHILD(t));
     }
-    else{                                                                       // if the block is in middle of the list
-        PUT(((char *)PREV_FREE(bp) + WSIZE), NEXT_FREE(bp));                    // set previous block's next to point to bp's next
-        PUT(((char *)NEXT_FREE(bp)), PREV_FREE(bp));                            // set next blocks's previous to previous block
+}
+
+/*
+ * returns the smallest block of the tree that fits asize bytes, the one at the lowest address if there are several
+ */
+static char *tree_best_fit(arena_t *a, size_t asize)
+{
+    char *t;
+
+    if (a->tree == NULL)
+        return NULL;
+    t = a->tree = tree_splay(a->tree, asize, NULL);                             // no block comes before address NULL, so this ends next to the fit
+    if (GET_SIZE(HDRP(t)) >= asize)
+        return t;
+    for (t = RIGHT_CHILD(t); t != NULL && LEFT_CHILD(t) != NULL; )              // otherwise the fit is the smallest block on the right
+        t = LEFT_CHILD(t);
+    return t;
+}
+
+/*
+ * returns the block that follows block bp in the order of the tree without changing the tree, or NULL if bp is the last one
+ */
+static char *tree_successor(arena_t *a, char *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *t, *next = NULL;
+
+    for (t = a->tree; t != NULL; ) {
+        if (KEY_LESS(size, bp, GET_SIZE(HDRP(t)), t)) {
+            next = t;
+            t = LEFT_CHILD(t);
+        }
+        else
+            t = RIGHT_CHILD(t);
     }
+    return next;
 }
 
 /*
- * checks if the blocks in the free list are not allocated
+ * checks if the blocks in the free lists are not allocated
  */
-static int correct_free_marked(void){
-    void *bp = free_listp;
-    for (bp = free_listp; bp != NULL; ) {                                       // iterate through the free list
-        if (GET_ALLOC(HDRP(bp))) {                                              // if any block is allocated
-            printf("Error: block in free list but marked allocated\n");         // print an error message
-            return 0;                                                           // return error
+static int correct_free_marked(arena_t *a){
+    int class;
+    void *bp;
+    for (class = 0; class < NUM_CLASSES; class++) {                             // iterate through every class
+        for (bp = a->seg_lists[class]; bp != NULL; bp = NEXT_FREE(bp)) {        // iterate through the free list of the class
+            if (GET_ALLOC(HDRP(bp))) {                                          // if any block is allocated
+                printf("Error: block in free list but marked allocated\n");    // print an error message
+                return 0;                                                       // return error
+            }
         }
-        bp = (char *)NEXT_FREE(bp);                                             // go to the next free block
     }
     return 1;
 }
@@ -343,8 +2036,8 @@ static int correct_free_marked(void){
 /*
  * checks that no blocks escaped coalescing
  */
-static int check_coalescing(){
-    char* bp = heap_listp;                                                       // pointer to the heap list
+static int check_coalescing(arena_t *a){
+    char* bp = a->heap_listp;                                                   // pointer to the heap list
     if(GET_ALLOC(bp) == 0){                                                      // if block not allocated
         if (NEXT_BLKP(bp) != NULL && !GET_ALLOC(HDRP(NEXT_BLKP(bp)))){           // and the next one is also not allocated
             printf("Error: next block not coalesced\n");                         // then the blocks are not coalesced, print error message
@@ -355,19 +2048,28 @@ static int check_coalescing(){
 }
 
 /*
- * checks that every free block of the heap is on the freelist.
+ * checks that every free block of the heap is on the free list of its class, or in the tree if it is large.
  */
-static int check_freelist(void){
-    void *bp = heap_listp;				                           // pointer to the heap list
+static int check_freelist(arena_t *a){
+    void *bp = a->heap_listp;				                           // pointer to the heap list
     while (bp != NULL && GET_SIZE(HDRP(bp)) != 0){                               // iterate through the heap list
-        if (GET_ALLOC(HDRP(bp)) == 0){ 		                           // if it finds a free block
-            void *cmp = free_listp;   		                           // get the beginning of the free blocks list
+        if (GET_ALLOC(HDRP(bp)) == 0 && GET_SIZE(HDRP(bp)) >= TREE_MIN) {       // a large free block has to be in the tree
+            char *t = a->tree;
+            while (t != NULL && t != bp)
+                t = KEY_LESS(GET_SIZE(HDRP(bp)), bp, GET_SIZE(HDRP(t)), t) ? LEFT_CHILD(t) : RIGHT_CHILD(t);
+            if (t == NULL) {
+                printf("Error: Free block %p not found in tree\n", bp);
+                return 0;
+            }
+        }
+        else if (GET_ALLOC(HDRP(bp)) == 0){ 		                           // if it finds a free block
+            void *cmp = a->seg_lists[size_class(GET_SIZE(HDRP(bp)))];           // get the beginning of the list of its class
             while (bp != cmp){  			                           // iterate through the free blocks list
-                if (GET_SIZE(HDRP(cmp)) == 0){                                   // if we reach the end of the list before finding the free block on the free list
+                if (cmp == NULL){                                                // if we reach the end of the list before finding the free block on the free list
                     printf("Error: Free block not found in freelist\n");         // return an error message
                     return 0;                                                    // return an error
                 }
-                cmp = (char *)NEXT_FREE(cmp);                                            // get the next block in the freelist
+                cmp = NEXT_FREE(cmp);                                            // get the next block in the freelist
             }
         }
         bp = NEXT_BLKP(bp);                                                      // get the next block in the heap list
@@ -375,12 +2077,38 @@ static int check_freelist(void){
     return 1;
 }
 
+/*
+ * checks every size class: its blocks belong to the class, the previous links mirror the next links
+ * and the bit in a->seg_mask matches whether the list is empty
+ */
+static int check_classes(arena_t *a){
+    int class;
+    char *bp, *prev;
+    for (class = 0; class < NUM_CLASSES; class++) {                              // iterate through every class
+        if ((a->seg_lists[class] != NULL) != ((a->seg_mask >> class) & 1)) {    // the bitmap must agree with the list head
+            printf("Error: a->seg_mask bit of class %d is wrong\n", class);
+            return 0;
+        }
+        prev = NULL;
+        for (bp = a->seg_lists[class]; bp != NULL; prev = bp, bp = NEXT_FREE(bp)) { // iterate through the free list of the class
+            if (size_class(GET_SIZE(HDRP(bp))) != class) {                       // a block of another size is on this list
+                printf("Error: block %p of size %u is on list of class %d\n", bp, GET_SIZE(HDRP(bp)), class);
+                return 0;
+            }
+            if (PREV_FREE(bp) != prev) {                                         // previous link doesn't point back to the previous block
+                printf("Error: broken previous link at %p in class %d\n", bp, class);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
 
 /*
  * check whether any of the allocated blocks overlap each other
  */
-static int check_overlap(void){
-    void *bp = heap_listp;                                                       // pointer to the heap list
+static int check_overlap(arena_t *a){
+    void *bp = a->heap_listp;                                                   // pointer to the heap list
     while(bp != NULL && GET_SIZE(HDRP(bp))!=0){                                  // iterate through the heap list
         if(GET_ALLOC(HDRP(bp))){                                                 // if pointed block is allocated
             if (bp + GET_SIZE(HDRP(bp)) - WSIZE >= (void*)NEXT_BLKP(bp)) {       // if current pointer + size is greater than address of next, there is an overlap
@@ -396,12 +2124,12 @@ static int check_overlap(void){
 /*
  * check to see if pointers in heap block point to a valid heap address
  *  - pointer has to be smaller than the next block pointers
- *  - pointer has to be aligned to 8
+ *  - pointer has to be aligned to ALIGNMENT
  */
-static int check_valid_heap(void){
+static int check_valid_heap(arena_t *a){
     char *bp;
-    for(bp = NEXT_BLKP(heap_listp); bp < epilogue; bp = NEXT_BLKP(bp)) {                      // iterate through the heap list
-        if((HDRP(bp) < HDRP(NEXT_BLKP(heap_listp))) || (GET_ALIGN(HDRP(bp)) != 8)) {          // if any of the conditions is true
+    for(bp = NEXT_BLKP(a->heap_listp); bp < a->epilogue; bp = NEXT_BLKP(bp)) {                      // iterate through the heap list
+        if((HDRP(bp) < HDRP(NEXT_BLKP(a->heap_listp))) || ((uintptr_t)bp % ALIGNMENT != 0)) {    // if any of the conditions is true
             printf("Error: current block does not point to a valid heap address: %p\n", bp);  // print an error message
             return 0;                                                                         // return an error
         }
@@ -410,16 +2138,113 @@ static int check_valid_heap(void){
 }
 
 /*
- * checks if both header and footer of the blocks in the free list are not allocated
+ * checks if both header and footer of the blocks in the free lists are not allocated
  */
-static int check_consistency(void){
-    char* free = free_listp;                                                                  // we use the free blocks list
-    for (; free != NULL; free = (char *) NEXT_FREE(free)){                                    // iterate through it
-        if (GET_ALLOC(HDRP(free)) || GET_ALLOC(FTRP(free))){                                  // if the header or the footer would be allocated
-            printf("Error: header and footer are inconsistent in free list \n");              // print an error message
-            return 0;                                                                         // return an error
+static int check_consistency(arena_t *a){
+    int class;
+    char* free;
+    for (class = 0; class < NUM_CLASSES; class++) {                                           // we use the free lists of all classes
+        for (free = a->seg_lists[class]; free != NULL; free = NEXT_FREE(free)){                  // iterate through it
+            if (GET_ALLOC(HDRP(free)) || GET_ALLOC(FTRP(free))){                              // if the header or the footer would be allocated
+                printf("Error: header and footer are inconsistent in free list \n");          // print an error message
+                return 0;                                                                     // return an error
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * checks that the PREV_ALLOC bit of every header matches the block before it and that every free block's footer matches its header
+ */
+static int check_prev_alloc(arena_t *a){
+    char *bp;
+    for (bp = a->heap_listp; GET_SIZE(HDRP(bp)) != 0; bp = NEXT_BLKP(bp)) {     // iterate through the heap list up to the epilogue
+        if (!GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))) != !GET_ALLOC(HDRP(bp))) {                   // the next header has to know whether this block is allocated
+            printf("Error: PREV_ALLOC bit after block %p is wrong\n", bp);
+            return 0;
+        }
+        if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp))) {              // free blocks need a footer that matches the header
+            printf("Error: header and footer of free block %p don't match\n", bp);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * checks the slabs on the lists: they are allocated SLAB_SIZE aligned blocks marked in the page map,
+ * belong to their class and the number of set bits in the free map matches nfree
+ */
+static int check_slabs(arena_t *a){
+    int class, i, count;
+    slab_t *s;
+    for (class = 0; class < SLAB_CLASSES; class++) {                             // iterate through every slab class
+        for (s = a->slabs[class]; s != NULL; s = s->next) {
+            if ((uintptr_t)s % SLAB_SIZE != 0 || !GET_ALLOC(HDRP(s)) || GET_SIZE(HDRP(s)) < SLAB_SIZE || slab_of(a, s) != s) {
+                printf("Error: slab %p is not an allocated block in the page map\n", s);
+                return 0;
+            }
+            for (i = 0, count = 0; i < SLAB_MAP_WORDS; i++)                      // count free slots
+                count += __builtin_popcount(s->free_map[i]);
+            if (s->class != class || count != s->nfree || s->nfree == 0 || s->nfree > s->nslots) {
+                printf("Error: slab %p of class %d has a wrong count of free slots\n", s, class);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * checks the tree: it is ordered by size and address and holds only free blocks of at least TREE_MIN bytes whose
+ * footer matches the header
+ */
+static int check_tree(arena_t *a){
+    return check_tree_node(a->tree, NULL, NULL, 0);
+}
+
+/*
+ * checks the subtree at t, whose keys have to lie between the keys of blocks lo and hi (NULL for no bound)
+ */
+static int check_tree_node(char *t, char *lo, char *hi, int depth){
+    if (t == NULL)
+        return 1;
+    if (depth > (1 << 20)) {                                                     // deeper than the heap has blocks, so there is a cycle
+        printf("Error: cycle in the tree at %p\n", t);
+        return 0;
+    }
+    if (GET_ALLOC(HDRP(t)) || GET_SIZE(HDRP(t)) < TREE_MIN || GET_SIZE(HDRP(t)) != GET_SIZE(FTRP(t))) {
+        printf("Error: block %p in the tree is not a large free block\n", t);
+        return 0;
+    }
+    if ((lo != NULL && !KEY_LESS(GET_SIZE(HDRP(lo)), lo, GET_SIZE(HDRP(t)), t)) ||
+        (hi != NULL && !KEY_LESS(GET_SIZE(HDRP(t)), t, GET_SIZE(HDRP(hi)), hi))) {
+        printf("Error: block %p is out of order in the tree\n", t);
+        return 0;
+    }
+    return check_tree_node(LEFT_CHILD(t), lo, t, depth + 1) && check_tree_node(RIGHT_CHILD(t), t, hi, depth + 1);
+}
+
+/*
+ * checks that the blocks on the quick lists are allocated heap blocks of the size of their list and that quick_blocks counts them
+ */
+static int check_quick(arena_t *a){
+    unsigned int count = 0;
+    int i;
+    char *bp;
+    for (i = 0; i < QUICK_BINS; i++) {                                           // iterate through every quick list
+        for (bp = a->quick[i]; bp != NULL; bp = NEXT_CACHED(bp), count++) {
+            if (!GET_ALLOC(HDRP(bp)) || GET_SIZE(HDRP(bp)) != i * ALIGNMENT || slab_of(a, bp) != NULL) {
+                printf("Error: block %p doesn't belong on quick list %d\n", bp, i);
+                return 0;
+            }
         }
     }
+    if (count != a->quick_blocks) {
+        printf("Error: quick lists hold %u blocks, quick_blocks is %u\n", count, a->quick_blocks);
+        return 0;
+    }
     return 1;
 }
 
@@ -429,23 +2254,146 @@ static int check_consistency(void){
  *   -  Are there any contiguous free blocks that somehow escaped coalescing? -> check_coalescing()
  *   -  Is every free block actually in the free list?                        -> check_freelist()
  *   -  Do the pointers in the free list point to valid free blocks?          -> check_consistency(), check_freelist()
+ *   -  Is every class list well formed and holding only its own sizes?       -> check_classes()
+ *   -  Do the PREV_ALLOC bits and the footers of free blocks agree?          -> check_prev_alloc()
  *   -  Do any allocated blocks overlap                                       -> check_overlap()
  *   -  Do the pointers in a heap block point to valid heap addresses?        -> check_valid_heap()
+ *   -  Is the tree of large blocks ordered and free?                         -> check_tree()
+ *   -  Are the slabs on the lists well formed?                               -> check_slabs()
+ *   -  Do the quick lists hold allocated blocks of their size?               -> check_quick()
  */
-int mm_check(void)
+static int arena_check(arena_t *a)
 {
-    if(correct_free_marked() == 0)
+    if(correct_free_marked(a) == 0)
+        return 0;
+    if (check_coalescing(a) == 0)
+        return 0;
+    if (check_freelist(a) == 0)
         return 0;
-    if (check_coalescing() == 0)
+    if (check_overlap(a) == 0)
         return 0;
-    if (check_freelist() == 0)
+    if (check_valid_heap(a) == 0)
         return 0;
-    if (check_overlap() == 0)
+    if(check_consistency(a) == 0)
+        return 0;
+    if (check_classes(a) == 0)
+        return 0;
+    if (check_prev_alloc(a) == 0)
+        return 0;
+    if (check_tree(a) == 0)
+        return 0;
+    if (check_slabs(a) == 0)
+        return 0;
+    if (check_quick(a) == 0)
+        return 0;
+
+    return 1;
+}
+
+/*
+ * runs the heapchecker on every arena that has a heap
+ */
+static int mm_check(void)
+{
+    int i, ok = 1;
+    for (i = 0; i < live_arenas && ok; i++) {
+        pthread_mutex_lock(&arenas[i].lock);
+        ok = arena_check(&arenas[i]);
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+    return ok;
+}
+
+#if MM_DEBUG
+/*
+ * checks heap block bp of arena a and its neighbours in a few steps: the block lies in the heap and is aligned, a free
+ * block has a matching footer and allocated neighbours, and the PREV_ALLOC bits on both sides tell the truth
+ */
+static int check_block(arena_t *a, char *bp){
+    size_t size = GET_SIZE(HDRP(bp));
+    char *next = NEXT_BLKP(bp);
+
+    if (bp <= a->heap_listp || HDRP(bp) >= a->epilogue || (uintptr_t)bp % ALIGNMENT != 0 ||
+        size < MINIMUM || size % ALIGNMENT != 0 || HDRP(next) > a->epilogue || GET_MMAPPED(HDRP(bp))) {
+        printf("Error: block %p of size %lu is not a valid heap block\n", bp, (unsigned long)size);
         return 0;
-    if (check_valid_heap() == 0)
+    }
+    if (!GET_PREV_ALLOC(HDRP(next)) != !GET_ALLOC(HDRP(bp))) {                  // the next header has to know whether this block is allocated
+        printf("Error: PREV_ALLOC bit after block %p is wrong\n", bp);
         return 0;
-    if(check_consistency() == 0)
+    }
+    if (!GET_PREV_ALLOC(HDRP(bp)) &&                                            // a free previous block has to end right here
+        (GET_ALLOC(HDRP(PREV_BLKP(bp))) || GET_SIZE(HDRP(PREV_BLKP(bp))) != GET_SIZE(HDRP(bp) - WSIZE))) {
+        printf("Error: free block before %p has a wrong header or footer\n", bp);
         return 0;
+    }
+    if (!GET_ALLOC(HDRP(bp))) {
+        if (GET(FTRP(bp)) != PACK(size, 0)) {
+            printf("Error: header and footer of free block %p don't match\n", bp);
+            return 0;
+        }
+        if (!GET_PREV_ALLOC(HDRP(bp)) || !GET_ALLOC(HDRP(next))) {
+            printf("Error: free block %p escaped coalescing\n", bp);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * checks the links of free block bp of arena a: in a class list its neighbours point back to it and belong to the same class,
+ * in the tree its children are free and on the right side of it
+ */
+static int check_free_node(arena_t *a, char *bp){
+    size_t size = GET_SIZE(HDRP(bp));
+    char *prev = PREV_FREE(bp), *next = NEXT_FREE(bp);
+    int class = size_class(size);
 
+    if (GET_ALLOC(HDRP(bp)) || GET(FTRP(bp)) != PACK(size, 0)) {
+        printf("Error: block %p on a free list is not free\n", bp);
+        return 0;
+    }
+    if (size >= TREE_MIN) {
+        if ((prev != NULL && (GET_ALLOC(HDRP(prev)) || !KEY_LESS(GET_SIZE(HDRP(prev)), prev, size, bp))) ||
+            (next != NULL && (GET_ALLOC(HDRP(next)) || !KEY_LESS(size, bp, GET_SIZE(HDRP(next)), next)))) {
+            printf("Error: children of %p in the tree are out of order\n", bp);
+            return 0;
+        }
+        return 1;
+    }
+    if ((prev == NULL ? a->seg_lists[class] != bp : NEXT_FREE(prev) != bp) ||
+        (next != NULL && (PREV_FREE(next) != bp || size_class(GET_SIZE(HDRP(next))) != class)) ||
+        !((a->seg_mask >> class) & 1)) {
+        printf("Error: broken links at %p in class %d\n", bp, class);
+        return 0;
+    }
     return 1;
 }
+
+/*
+ * ends an operation on arena a that returned block or slot bp (NULL for none): checks that block, or the slab that holds the
+ * slot, and runs the full heap checker every MM_CHECK_EVERY operations
+ */
+static void debug_op(arena_t *a, void *bp){
+    slab_t *s;
+
+    if (bp != NULL) {
+        s = slab_of(a, bp);
+        debug_assert(check_block(a, (s != NULL) ? (char *)s : (char *)bp));
+    }
+    if (MM_CHECK_EVERY != 0 && ++a->check_ops >= MM_CHECK_EVERY) {
+        a->check_ops = 0;
+        debug_assert(arena_check(a));
+    }
+}
+
+/*
+ * aborts if a check failed, after the error message is out
+ */
+static void debug_assert(int ok){
+    if (!ok) {
+        fflush(stdout);
+        abort();
+    }
+}
+#endif
@@ -5,6 +5,139 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/*
+ * mm_memalign returns a block of size bytes whose address is a multiple
+ * of align, a power of two. Free it with mm_free like any other block.
+ * mm_realloc keeps only the normal alignment of the block it returns.
+ */
+extern void *mm_memalign(size_t align, size_t size);
+
+/*
+ * mm_calloc returns a cleared block for nmemb elements of size bytes, or
+ * NULL if their product overflows. Blocks cut from heap memory that was
+ * never used are zero already and aren't cleared again.
+ */
+extern void *mm_calloc(size_t nmemb, size_t size);
+
+/*
+ * mm_usable_size returns the number of payload bytes of the block at
+ * ptr, which can be more than were asked for. ptr must be a live block
+ * of the mm package.
+ */
+extern size_t mm_usable_size(void *ptr);
+
+/*
+ * Placement policies used by find_fit. mm_set_policy selects one of them,
+ * it takes effect at the next call of mm_init. nfit is the number of fitting
+ * candidates MM_GOOD_FIT compares before it picks the smallest one.
+ */
+typedef enum {
+    MM_FIRST_FIT,   /* first block that fits */
+    MM_NEXT_FIT,    /* first fit, starting at a roving pointer */
+    MM_GOOD_FIT,    /* smallest of the first nfit blocks that fit */
+    MM_BEST_FIT     /* smallest block that fits */
+} mm_policy_t;
+
+extern void mm_set_policy(mm_policy_t policy, int nfit);
+
+/*
+ * Threads are spread over n independent arenas, each with its own lock.
+ * Like the policy, the number takes effect at the next call of mm_init.
+ */
+extern void mm_set_arenas(int n);
+
+/*
+ * Once the free block at the end of the heap is larger than threshold
+ * bytes, it is cut down to pad bytes and the rest is given back with
+ * mem_trim. A threshold of 0 never trims. Takes effect at mm_init.
+ */
+extern void mm_set_trim(size_t threshold, size_t pad);
+
+/*
+ * If on is set, freed blocks of up to 1 KB wait on quick lists of their
+ * size and are only coalesced once a request finds no fit. Off by
+ * default. Takes effect at mm_init.
+ */
+extern void mm_set_deferred(int on);
+
+/*
+ * Requests of threshold bytes or more get a mapping of their own, which
+ * mm_free gives back to the system and mm_realloc resizes with mremap.
+ * Heap blocks that mm_realloc grows past it stay in the heap, where they
+ * can grow in place. The default is 256 KB, 0 keeps every block in the
+ * heap. Takes effect at mm_init.
+ */
+extern void mm_set_mmap_threshold(size_t threshold);
+
+/*
+ * Counters of the heap that the last mm_init created, summed over all
+ * arenas. They say why a trace is slow or wasteful: how long the fit
+ * searches are, how blocks are split and coalesced, and how much of the
+ * blocks handed out the requests don't use. Building with -DMM_STATS=0
+ * compiles the counting out and mm_stats returns zeros.
+ */
+typedef struct {
+    size_t heap_grows;      /* number of times the heap was extended */
+    size_t heap_grow_bytes; /* bytes it was extended by */
+    size_t heap_trims;      /* number of times its end was given back */
+    size_t heap_trim_bytes; /* bytes given back */
+    size_t mallocs;         /* blocks handed out by the arenas */
+    size_t malloc_bytes;    /* bytes requested for them */
+    size_t block_bytes;     /* bytes of the blocks and slots they got */
+    size_t free_blocks;     /* free blocks in the lists and the tree now */
+    size_t free_bytes;      /* bytes in these free blocks */
+    size_t fit_searches;    /* searches for a fitting free block */
+    size_t fit_steps;       /* list blocks looked at by the searches */
+    size_t fit_misses;      /* searches that found no fit */
+    size_t splits;          /* fits that were split by place */
+    size_t coalesces[4];    /* frees whose neighbours were: none, the */
+                            /* next, the previous or both free */
+    size_t slabs;           /* slabs in use now */
+    size_t consolidations;  /* passes that freed the deferred blocks */
+    size_t grow_step;       /* largest growth step of an arena now */
+} mm_stats_t;
+
+extern mm_stats_t mm_stats(void);
+
+/*
+ * mm_walk calls f for every block in the heaps of the last mm_init, in
+ * address order and arena by arena, with the address of its payload, the
+ * size of the whole block and what it is. Blocks on the quick lists of
+ * deferred coalescing look allocated, blocks that have a mapping of their
+ * own are not part of any heap. f runs with the lock of the arena held
+ * and must not call the mm package.
+ */
+typedef enum {
+    MM_BLOCK_FREE,          /* on a free list or the tree */
+    MM_BLOCK_ALLOC,         /* handed out by mm_malloc & co. */
+    MM_BLOCK_SLAB           /* allocated and cut into small slots */
+} mm_block_t;
+
+typedef void (*mm_walk_fn)(void *arg, int arena, void *bp, size_t size,
+                           mm_block_t state);
+
+extern void mm_walk(mm_walk_fn f, void *arg);
+
+/*
+ * Hooks for pthread_atfork. mm_fork_prepare takes the lock of the arenas
+ * and the lock of each arena, so no other thread holds one of them while
+ * the process is copied. mm_fork_parent releases them again, and
+ * mm_fork_child starts the child, which has only the forking thread,
+ * with all of them unlocked.
+ */
+extern void mm_fork_prepare(void);
+extern void mm_fork_parent(void);
+extern void mm_fork_child(void);
+
+/*
+ * Batch requests take the arena lock once for all n blocks. mm_malloc_batch
+ * cuts n blocks of the same size from one fit and returns how many it could
+ * allocate. mm_free_batch sorts ptrs by address and frees neighbouring
+ * blocks as one, so they are coalesced once.
+ */
+extern int mm_malloc_batch(size_t size, int n, void **ptrs);
+extern void mm_free_batch(int n, void **ptrs);
+
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, 
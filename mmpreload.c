@@ -0,0 +1,496 @@
+/*
+ * mmpreload.c - Runs the mm malloc package as the malloc of any program.
+ *     Built as a shared library ("make libmm.so") and preloaded:
+ *
+ *     unix> LD_PRELOAD=./libmm.so ls -l
+ *     unix> LD_PRELOAD=./libmm.so MM_TRACE=ls.bin ls -l
+ *     unix> mdriver -f ls.bin
+ *
+ * malloc, free, realloc, calloc and the aligned allocation calls are
+ * served by mm_malloc, mm_memalign, mm_calloc, mm_free and mm_realloc on
+ * heaps that memlib reserves with mmap, so they can grow to MM_MAX_HEAP
+ * bytes (default 1 GB each). Pointers that memlib didn't hand out were
+ * allocated by libc before us and go back to libc.
+ *
+ * With MM_TRACE set, every request is recorded in the binary trace
+ * format of trace.h. The requests are buffered and written in blocks,
+ * the header is rewritten after each block, so the file is a valid
+ * trace even if the program dies. A request of more than INT_MAX bytes
+ * doesn't fit the trace format, the recording stops before it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+#include "trace.h"
+
+#define TRACE_BUF (1<<12)          /* requests buffered before a write */
+#define IDS_MIN (1<<12)            /* initial size of the table of ids */
+
+/* glibc's own allocator, for the blocks we didn't allocate */
+extern void *__libc_malloc(size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/* Live block address and the id it has in the trace */
+typedef struct {
+    void *ptr;
+    int id;
+} idslot_t;
+
+/* Set up state */
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static volatile int ready = 0;
+
+/* Recording state, all of it is protected by trace_lock */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int trace_fd = -1;
+static tracehdr_t trace_hdr;
+static traceop_t trace_buf[TRACE_BUF];
+static int trace_len = 0;
+static idslot_t *ids = NULL;         /* open addressing table by address */
+static size_t ids_size = 0, ids_used = 0;
+
+static void init(void);
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+static void finish(void) __attribute__((destructor));
+static void record(int type, void *ptr, size_t size, size_t align);
+static void record_move(void *oldp, void *newp, size_t size);
+static void flush_trace(void);
+static int trace_fits(size_t size, size_t align);
+static size_t id_slot(void *ptr);
+static void id_insert(void *ptr, int id);
+static int id_remove(void *ptr);
+static void ids_grow(void);
+static void *align_block(size_t alignment, size_t size);
+
+/*
+ * init - Create the heap on first use. memlib reserves it with mmap,
+ *     its malloc backend would call us back.
+ */
+static void init(void)
+{
+    char *env;
+
+    mem_set_backend(MEM_BACKEND_MMAP);
+    mem_set_max_heap((env = getenv("MM_MAX_HEAP")) != NULL ?
+		     strtoul(env, NULL, 0) : (size_t)1 << 30);
+    mem_init();
+    if (mm_init() < 0) {
+	fprintf(stderr, "mmpreload: mm_init failed\n");
+	abort();
+    }
+
+    if ((env = getenv("MM_TRACE")) != NULL) {
+	if ((trace_fd = open(env, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+	    fprintf(stderr, "mmpreload: could not open %s: %s\n",
+		    env, strerror(errno));
+	memcpy(trace_hdr.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+	trace_hdr.op_size = sizeof(traceop_t);
+	trace_hdr.weight = 1;
+	flush_trace();
+    }
+    ready = 1;
+
+    /* Last, registering the hooks may call malloc */
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+/*
+ * fork_prepare - Take every lock of the shim, of mm and of memlib before
+ *     the program forks, in the order the allocation calls take them:
+ *     trace_lock is held across mm_realloc, and the arenas call memlib
+ * fork_parent - Release them again in the parent
+ * fork_child - Reset them in the child, whose only thread is the one
+ *     that forked. Nothing else could have held them.
+ */
+static void fork_prepare(void)
+{
+    pthread_mutex_lock(&trace_lock);
+    mm_fork_prepare();
+    mem_fork_prepare();
+}
+
+static void fork_parent(void)
+{
+    mem_fork_parent();
+    mm_fork_parent();
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void fork_child(void)
+{
+    mem_fork_child();
+    mm_fork_child();
+    pthread_mutex_init(&trace_lock, NULL);
+}
+
+/*
+ * finish - Write what is left of the trace when the program exits
+ */
+static void finish(void)
+{
+    if (trace_fd < 0)
+	return;
+    pthread_mutex_lock(&trace_lock);
+    flush_trace();
+    close(trace_fd);
+    trace_fd = -1;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/*
+ * record - Add an ALLOC, MEMALIGN, CALLOC or FREE of the block at ptr
+ *     to the trace. An allocation gets a new id, a free uses the id the block has.
+ */
+static void record(int type, void *ptr, size_t size, size_t align)
+{
+    int id;
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd < 0 || !trace_fits(size, align)) {
+	pthread_mutex_unlock(&trace_lock);
+	return;
+    }
+    if (type != FREE) {
+	id = trace_hdr.num_ids++;
+	id_insert(ptr, id);
+    }
+    else if ((id = id_remove(ptr)) < 0) {  /* not allocated while recording */
+	pthread_mutex_unlock(&trace_lock);
+	return;
+    }
+    trace_buf[trace_len].type = type;
+    trace_buf[trace_len].index = id;
+    trace_buf[trace_len].size = (int)size;
+    trace_buf[trace_len].align = (int)align;
+    if (++trace_len == TRACE_BUF)
+	flush_trace();
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/*
+ * record_move - Add a REALLOC of the block at oldp, which now is at newp,
+ *     to the trace. The caller holds trace_lock across the realloc, so
+ *     no other thread can get oldp before its id moved to newp.
+ */
+static void record_move(void *oldp, void *newp, size_t size)
+{
+    int id;
+
+    if (!trace_fits(size, 0))
+	return;
+    if ((id = id_remove(oldp)) < 0) {    /* not allocated while recording */
+	id = trace_hdr.num_ids++;
+	trace_buf[trace_len].type = ALLOC;
+    }
+    else
+	trace_buf[trace_len].type = REALLOC;
+    id_insert(newp, id);
+    trace_buf[trace_len].index = id;
+    trace_buf[trace_len].size = (int)size;
+    trace_buf[trace_len].align = 0;
+    if (++trace_len == TRACE_BUF)
+	flush_trace();
+}
+
+/*
+ * flush_trace - Write the buffered requests and the header with the
+ *     current counts, the caller holds trace_lock
+ */
+static void flush_trace(void)
+{
+    size_t bytes = trace_len * sizeof(traceop_t);
+    off_t end = sizeof(tracehdr_t) +
+	(off_t)trace_hdr.num_ops * sizeof(traceop_t);
+
+    if (trace_fd < 0)
+	return;
+    if (bytes != 0 && pwrite(trace_fd, trace_buf, bytes, end) != (ssize_t)bytes) {
+	fprintf(stderr, "mmpreload: writing the trace failed, stopped\n");
+	close(trace_fd);
+	trace_fd = -1;
+	return;
+    }
+    trace_hdr.num_ops += trace_len;
+    trace_len = 0;
+    pwrite(trace_fd, &trace_hdr, sizeof(trace_hdr), 0);
+}
+
+/*
+ * trace_fits - Return 1 if a request of size bytes aligned to align can
+ *     be recorded, otherwise stop the recording where it is, before the
+ *     request, and return 0. The caller holds trace_lock.
+ */
+static int trace_fits(size_t size, size_t align)
+{
+    if (size <= INT_MAX && align <= INT_MAX)
+	return 1;
+    flush_trace();
+    if (trace_fd >= 0) {
+	fprintf(stderr, "mmpreload: request of %lu bytes is too large for "
+		"the trace, stopped\n", (unsigned long)size);
+	close(trace_fd);
+	trace_fd = -1;
+    }
+    return 0;
+}
+
+/*
+ * id_slot - Return the slot of ptr in the table of ids, or the empty
+ *     slot where it would go
+ */
+static size_t id_slot(void *ptr)
+{
+    size_t i = ((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL & (ids_size - 1);
+
+    while (ids[i].ptr != NULL && ids[i].ptr != ptr)
+	i = (i + 1) & (ids_size - 1);
+    return i;
+}
+
+/*
+ * id_insert - Remember that the block at ptr has id
+ */
+static void id_insert(void *ptr, int id)
+{
+    size_t i;
+
+    if (2 * (ids_used + 1) > ids_size)
+	ids_grow();
+    i = id_slot(ptr);
+    if (ids[i].ptr == NULL)
+	ids_used++;
+    ids[i].ptr = ptr;
+    ids[i].id = id;
+}
+
+/*
+ * id_remove - Forget the block at ptr and return its id, or -1 if it
+ *     has none. The entries behind it move up to close the gap.
+ */
+static int id_remove(void *ptr)
+{
+    size_t i, j, home;
+    int id;
+
+    if (ids_size == 0 || ids[i = id_slot(ptr)].ptr == NULL)
+	return -1;
+    id = ids[i].id;
+    for (j = (i + 1) & (ids_size - 1); ids[j].ptr != NULL;
+	 j = (j + 1) & (ids_size - 1)) {
+	home = ((uintptr_t)ids[j].ptr >> 4) * 0x9E3779B97F4A7C15ULL &
+	    (ids_size - 1);
+	if (((j - home) & (ids_size - 1)) >= ((j - i) & (ids_size - 1))) {
+	    ids[i] = ids[j];        /* j may move back to the gap at i */
+	    i = j;
+	}
+    }
+    ids[i].ptr = NULL;
+    ids_used--;
+    return id;
+}
+
+/*
+ * ids_grow - Double the table of ids. It lives in a mapping of its own,
+ *     malloc would come back to us.
+ */
+static void ids_grow(void)
+{
+    idslot_t *old = ids;
+    size_t old_size = ids_size, i;
+
+    ids_size = (old_size == 0) ? IDS_MIN : 2 * old_size;
+    ids = mmap(NULL, ids_size * sizeof(idslot_t), PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ids == MAP_FAILED) {
+	fprintf(stderr, "mmpreload: out of memory for the trace\n");
+	abort();
+    }
+    ids_used = 0;
+    for (i = 0; i < old_size; i++)
+	if (old[i].ptr != NULL)
+	    id_insert(old[i].ptr, old[i].id);
+    if (old != NULL)
+	munmap(old, old_size * sizeof(idslot_t));
+}
+
+/*
+ * align_block - Allocate size bytes aligned to alignment, a power of two.
+ *     Every block is aligned to ALIGNMENT, larger alignments take
+ *     mm_memalign.
+ */
+static void *align_block(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment <= ALIGNMENT)
+	return malloc(size);
+    if (!ready)
+	pthread_once(&init_once, init);
+    if ((p = mm_memalign(alignment, (size == 0) ? 1 : size)) == NULL) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (trace_fd >= 0)
+	record(MEMALIGN, p, size, alignment);
+    return p;
+}
+
+/*
+ * The interface of the process malloc
+ */
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (!ready)
+	pthread_once(&init_once, init);
+    if ((p = mm_malloc(size)) == NULL) {
+	if (size == 0)              /* malloc(0) has to return a pointer */
+	    return malloc(1);
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (trace_fd >= 0)
+	record(ALLOC, p, size, 0);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL)
+	return;
+    if (!ready || !mem_contains(ptr)) {
+	__libc_free(ptr);
+	return;
+    }
+    if (trace_fd >= 0)              /* before anyone else can get ptr */
+	record(FREE, ptr, 0, 0);
+    mm_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (!ready || !mem_contains(ptr))
+	return __libc_realloc(ptr, size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    if (trace_fd < 0) {
+	if ((p = mm_realloc(ptr, size)) == NULL)
+	    errno = ENOMEM;
+	return p;
+    }
+    pthread_mutex_lock(&trace_lock);
+    if ((p = mm_realloc(ptr, size)) == NULL)
+	errno = ENOMEM;
+    else if (trace_fd >= 0)
+	record_move(ptr, p, size);
+    pthread_mutex_unlock(&trace_lock);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (size != 0 && nmemb > (size_t)-1 / size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (!ready)
+	pthread_once(&init_once, init);
+    if (nmemb == 0 || size == 0)        /* calloc(0) has to return a pointer */
+	nmemb = size = 1;
+    if ((p = mm_calloc(nmemb, size)) == NULL) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (trace_fd >= 0)
+	record(CALLOC, p, nmemb * size, 0);
+    return p;
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > (size_t)-1 / size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+	return EINVAL;
+    if ((p = align_block(alignment, size)) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    return align_block(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    return align_block(getpagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = getpagesize();
+
+    return align_block(page, (size + page - 1) & ~(page - 1));
+}
+
+/*
+ * malloc_usable_size - The payload bytes of a block. Blocks that libc
+ *     allocated before us are asked about with libc's own version.
+ */
+size_t malloc_usable_size(void *ptr)
+{
+    static size_t (*libc_usable_size)(void *) = NULL;
+
+    if (ptr == NULL)
+	return 0;
+    if (ready && mem_contains(ptr))
+	return mm_usable_size(ptr);
+    if (libc_usable_size == NULL &&
+	(libc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size")) == NULL)
+	return 0;
+    return libc_usable_size(ptr);
+}
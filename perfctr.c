@@ -0,0 +1,115 @@
+/*
+ * perfctr.c - Count the hardware events of a function f with the Linux
+ *     perf_event_open system call.
+ *
+ * Each event gets a counter of its own rather than one group, so that a
+ * machine without, say, a dTLB event still counts the others. When the
+ * kernel has more events than hardware counters it multiplexes them,
+ * and each count is scaled up by the fraction of the time it ran.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+char *perfctr_names[PERFCTR_NUM] = {
+    "instructions", "l1d_misses", "llc_misses", "dtlb_misses", 
+    "branch_misses", "page_faults"
+};
+
+static int fds[PERFCTR_NUM];  /* the counter of each event, or -1 */
+static int initialized = 0;   /* have the counters been opened? */
+
+#ifdef __linux__
+/* The perf_event_attr type and config of each event */
+#define CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static struct {
+    unsigned type;
+    unsigned long long config;
+} events[PERFCTR_NUM] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+#endif
+
+/*
+ * perfctr_init - Open a disabled counter of the user space events of
+ *     this thread for each event
+ */
+int perfctr_init(void)
+{
+    int i, n = 0;
+#ifdef __linux__
+    struct perf_event_attr attr;
+#endif
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+	fds[i] = -1;
+#ifdef __linux__
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1; /* allowed with perf_event_paranoid up to 2 */
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | 
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+	if (fds[i] >= 0)
+	    n++;
+    }
+    initialized = 1;
+    return n;
+}
+
+/*
+ * perfctr_count - Count the events of one run of f(argp)
+ */
+void perfctr_count(perfctr_test_funct f, void *argp, double *counts)
+{
+    int i;
+    unsigned long long value[3]; /* count, time enabled, time running */
+
+    if (!initialized)
+	perfctr_init();
+
+#ifdef __linux__
+    for (i = 0; i < PERFCTR_NUM; i++)
+	if (fds[i] >= 0) {
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+    f(argp);
+#ifdef __linux__
+    for (i = 0; i < PERFCTR_NUM; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+	counts[i] = -1;
+	if (fds[i] < 0 || 
+	    read(fds[i], value, sizeof(value)) != sizeof(value))
+	    continue;
+	if (value[2] == 0) /* never got a hardware counter */
+	    counts[i] = (value[1] == 0) ? 0 : -1;
+	else
+	    counts[i] = (double)value[0] * value[1] / value[2];
+    }
+}
@@ -0,0 +1,33 @@
+/*
+ * perfctr.h - prototypes for the routines in perfctr.c that count the
+ *     hardware events of a test function f with Linux perf_event_open
+ */
+
+/* The test function takes a generic pointer as input */
+typedef void (*perfctr_test_funct)(void *);
+
+/* The events that are counted, in the order of the counts array */
+#define PERFCTR_INSTRUCTIONS  0 /* instructions retired */
+#define PERFCTR_L1D_MISSES    1 /* L1 data cache load misses */
+#define PERFCTR_LLC_MISSES    2 /* last level cache misses */
+#define PERFCTR_DTLB_MISSES   3 /* data TLB load misses */
+#define PERFCTR_BRANCH_MISSES 4 /* mispredicted branches */
+#define PERFCTR_PAGE_FAULTS   5 /* page faults (a software event) */
+#define PERFCTR_NUM           6
+
+/* Names of the events, for tables and results files */
+extern char *perfctr_names[PERFCTR_NUM];
+
+/* 
+ * perfctr_init - Open a counter for each event in this thread. Returns
+ *     how many events can be counted, 0 if the kernel or the machine 
+ *     (e.g. a virtual one) supports none of them.
+ */
+int perfctr_init(void);
+
+/* 
+ * perfctr_count - Run f(argp) once and store in counts the number of
+ *     times each event happened in user space, or -1 for the events 
+ *     that can't be counted
+ */
+void perfctr_count(perfctr_test_funct f, void *argp, double *counts);
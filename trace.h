@@ -0,0 +1,39 @@
+/*
+ * trace.h - The trace requests and the binary trace format shared
+ *     by mdriver and tracecvt
+ *
+ * A binary trace is a tracehdr_t followed by num_ops packed traceop_t
+ * structs, so mdriver can mmap it and use the requests in place.
+ * tracecvt converts between .rep text files and binary traces.
+ *
+ * In a .rep file, "a id size" allocates block id, "m id align size"
+ * allocates it aligned to align bytes, "c id size" allocates it cleared,
+ * "r id size" reallocates it and "f id" frees it.
+ */
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC, MEMALIGN, CALLOC} type; /* type of request */
+    int index;                        /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+    int align;                        /* alignment of a memalign request */
+} traceop_t;
+
+/* First bytes of every binary trace */
+#define TRACE_MAGIC "MMTRACE1"
+#define TRACE_MAGIC_LEN 8
+
+/* Header of a binary trace, the requests follow right after it */
+typedef struct {
+    char magic[TRACE_MAGIC_LEN]; /* TRACE_MAGIC */
+    int op_size;         /* sizeof(traceop_t) of the writer */
+    int sugg_heapsize;   /* the four numbers of a .rep header */
+    int num_ids;
+    int num_ops;
+    int weight;
+    int unused;          /* keeps the requests 8-byte aligned */
+} tracehdr_t;
+
+#endif /* __TRACE_H_ */
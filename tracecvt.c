@@ -0,0 +1,193 @@
+/*
+ * tracecvt.c - Converts trace files between the .rep text format and
+ *     the binary format of trace.h that mdriver can mmap directly.
+ *
+ *     unix> tracecvt amptjp-bal.rep amptjp-bal.bin
+ *     unix> tracecvt amptjp-bal.bin amptjp-bal.rep
+ *
+ * The direction follows from the format of the input file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+static void rep_to_bin(FILE *in, FILE *out, char *inname);
+static void bin_to_rep(FILE *in, FILE *out, char *inname);
+static void unix_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    char magic[TRACE_MAGIC_LEN];
+    char msg[MAXLINE];
+    int binary;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: tracecvt <infile> <outfile>\n");
+	fprintf(stderr, "Converts a .rep trace to a binary one or back.\n");
+	exit(1);
+    }
+    if ((in = fopen(argv[1], "rb")) == NULL) {
+	sprintf(msg, "Could not open %s", argv[1]);
+	unix_error(msg);
+    }
+    binary = (fread(magic, 1, TRACE_MAGIC_LEN, in) == TRACE_MAGIC_LEN &&
+	      !memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN));
+    rewind(in);
+    if ((out = fopen(argv[2], binary ? "w" : "wb")) == NULL) {
+	sprintf(msg, "Could not open %s", argv[2]);
+	unix_error(msg);
+    }
+
+    if (binary)
+	bin_to_rep(in, out, argv[1]);
+    else
+	rep_to_bin(in, out, argv[1]);
+
+    fclose(in);
+    if (fclose(out) != 0) {
+	sprintf(msg, "Could not write %s", argv[2]);
+	unix_error(msg);
+    }
+    exit(0);
+}
+
+/*
+ * rep_to_bin - Parse a .rep trace the way mdriver does and write the
+ *     header and the packed requests
+ */
+static void rep_to_bin(FILE *in, FILE *out, char *inname)
+{
+    tracehdr_t hdr;
+    traceop_t *ops;
+    char type[MAXLINE];
+    unsigned index, size, align;
+    int max_index = -1;
+    int n = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    hdr.op_size = sizeof(traceop_t);
+    if (fscanf(in, "%d %d %d %d", &hdr.sugg_heapsize, &hdr.num_ids,
+	       &hdr.num_ops, &hdr.weight) != 4 || hdr.num_ops < 0) {
+	fprintf(stderr, "Bad header in tracefile %s\n", inname);
+	exit(1);
+    }
+    if ((ops = (traceop_t *)malloc(hdr.num_ops * sizeof(traceop_t) + 1)) == NULL)
+	unix_error("malloc failed in rep_to_bin");
+
+    while (fscanf(in, "%s", type) != EOF) {
+	if (n == hdr.num_ops) {
+	    fprintf(stderr, "More than %d requests in tracefile %s\n",
+		    hdr.num_ops, inname);
+	    exit(1);
+	}
+	size = align = 0;
+	switch(type[0]) {
+	case 'a':
+	case 'c':
+	case 'r':
+	    if (fscanf(in, "%u %u", &index, &size) != 2) {
+		fprintf(stderr, "Bad request %d in tracefile %s\n", n, inname);
+		exit(1);
+	    }
+	    ops[n].type = (type[0] == 'a') ? ALLOC : 
+		(type[0] == 'c') ? CALLOC : REALLOC;
+	    break;
+	case 'm':
+	    if (fscanf(in, "%u %u %u", &index, &align, &size) != 3) {
+		fprintf(stderr, "Bad request %d in tracefile %s\n", n, inname);
+		exit(1);
+	    }
+	    ops[n].type = MEMALIGN;
+	    break;
+	case 'f':
+	    if (fscanf(in, "%u", &index) != 1) {
+		fprintf(stderr, "Bad request %d in tracefile %s\n", n, inname);
+		exit(1);
+	    }
+	    ops[n].type = FREE;
+	    break;
+	default:
+	    fprintf(stderr, "Bogus type character (%c) in tracefile %s\n",
+		    type[0], inname);
+	    exit(1);
+	}
+	ops[n].index = index;
+	ops[n].size = size;
+	ops[n].align = align;
+	max_index = ((int)index > max_index) ? (int)index : max_index;
+	n++;
+    }
+
+    /* mdriver would refuse a trace whose header doesn't match, check now */
+    if (n != hdr.num_ops || max_index != hdr.num_ids - 1) {
+	fprintf(stderr, "Header of tracefile %s doesn't match its requests\n",
+		inname);
+	exit(1);
+    }
+
+    fwrite(&hdr, sizeof(hdr), 1, out);
+    fwrite(ops, sizeof(traceop_t), n, out);
+    free(ops);
+}
+
+/*
+ * bin_to_rep - Write the requests of a binary trace as a .rep file
+ */
+static void bin_to_rep(FILE *in, FILE *out, char *inname)
+{
+    tracehdr_t hdr;
+    traceop_t op;
+    int i;
+
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 ||
+	hdr.op_size != sizeof(traceop_t)) {
+	fprintf(stderr, "Bad header in tracefile %s\n", inname);
+	exit(1);
+    }
+    fprintf(out, "%d\n%d\n%d\n%d\n",
+	    hdr.sugg_heapsize, hdr.num_ids, hdr.num_ops, hdr.weight);
+
+    for (i = 0; i < hdr.num_ops; i++) {
+	if (fread(&op, sizeof(op), 1, in) != 1) {
+	    fprintf(stderr, "Tracefile %s ends after %d requests\n", inname, i);
+	    exit(1);
+	}
+	switch (op.type) {
+	case ALLOC:
+	    fprintf(out, "a %d %d\n", op.index, op.size);
+	    break;
+	case REALLOC:
+	    fprintf(out, "r %d %d\n", op.index, op.size);
+	    break;
+	case MEMALIGN:
+	    fprintf(out, "m %d %d %d\n", op.index, op.align, op.size);
+	    break;
+	case CALLOC:
+	    fprintf(out, "c %d %d\n", op.index, op.size);
+	    break;
+	case FREE:
+	    fprintf(out, "f %d\n", op.index);
+	    break;
+	default:
+	    fprintf(stderr, "Bogus request type (%d) in tracefile %s\n",
+		    op.type, inname);
+	    exit(1);
+	}
+    }
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
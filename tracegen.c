@@ -0,0 +1,431 @@
+/*
+ * tracegen.c - Generates synthetic trace files for stress and scaling
+ *     runs of mdriver. Block sizes and lifetimes follow the given
+ *     distributions, lifetimes count the allocations a block survives.
+ *
+ *     unix> tracegen -n 2000000 -s lognormal:96:1.2 -l exp:5000 \
+ *               -r 0.05 -P 64M -S 7 big.rep
+ *     unix> mdriver -H 1G -f big.rep
+ *
+ * The same seed always writes the same trace. With -b the trace is
+ * written in the binary format of trace.h instead of as a .rep file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+#define MAX_SIZE (1<<30) /* largest block a request may ask for */
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* A distribution of block sizes or lifetimes */
+typedef struct {
+    enum {FIXED, UNIFORM, LOGNORMAL, BIMODAL, POWER, EXPONENTIAL} type;
+    double a, b, c;  /* parameters, their meaning depends on the type */
+} dist_t;
+
+/* A live block, the heap of live blocks is ordered by death */
+typedef struct {
+    long death;      /* number of allocations after which it is freed */
+    int id;          /* index of the block in the trace */
+} live_t;
+
+/* The trace being generated */
+static traceop_t *ops;
+static int num_ops = 0, max_ops = 0;
+static int *sizes;   /* size of each block id */
+static int *slot;    /* position of each live id in live_ids, -1 if dead */
+static int *live_ids;/* the live block ids, to pick realloc victims */
+static int num_live = 0;
+static live_t *heap; /* min-heap of the live blocks by death */
+static int heap_len = 0;
+static long live_bytes = 0;
+
+static unsigned long long rng_state;
+
+static void parse_dist(char *arg, dist_t *d);
+static long parse_size(char *arg);
+static double draw(dist_t *d);
+static double rnd(void);
+static void emit(int type, int id, int size);
+static void heap_push(long death, int id);
+static int heap_pop(void);
+static void free_block(int id);
+static void write_rep(FILE *out, int num_ids, int weight);
+static void write_bin(FILE *out, int num_ids, int weight);
+static void usage(void);
+static void unix_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    dist_t size_dist = {LOGNORMAL, 64, 1.0, 0};
+    dist_t life_dist = {EXPONENTIAL, 1000, 0, 0};
+    long target = 100000;       /* number of requests to generate */
+    long peak = 0;              /* cap on the live payload bytes, 0 is none */
+    double realloc_ratio = 0;   /* share of the requests that are reallocs */
+    double calloc_ratio = 0;    /* share of the allocations that are callocs */
+    unsigned long seed = 1;
+    int binary = 0, weight = 1;
+    long now = 0;               /* allocations so far, the clock of deaths */
+    int num_ids = 0, max_ids;
+    int c, id, size;
+    double x;                   /* a draw, clamped before it becomes an int */
+    char msg[MAXLINE];
+    FILE *out;
+
+    while ((c = getopt(argc, argv, "n:s:l:r:c:P:S:w:bh")) != EOF) {
+	switch (c) {
+	case 'n': /* Number of requests */
+	    target = parse_size(optarg);
+	    break;
+	case 's': /* Distribution of the block sizes in bytes */
+	    parse_dist(optarg, &size_dist);
+	    break;
+	case 'l': /* Distribution of the lifetimes in allocations */
+	    parse_dist(optarg, &life_dist);
+	    break;
+	case 'r': /* Share of reallocs among the requests */
+	    realloc_ratio = atof(optarg);
+	    break;
+	case 'c': /* Share of callocs among the allocations */
+	    calloc_ratio = atof(optarg);
+	    break;
+	case 'P': /* Largest number of live payload bytes */
+	    peak = parse_size(optarg);
+	    break;
+	case 'S': /* Seed of the random numbers */
+	    seed = strtoul(optarg, NULL, 0);
+	    break;
+	case 'w': /* Weight of the trace in the header */
+	    weight = atoi(optarg);
+	    break;
+	case 'b': /* Write a binary trace */
+	    binary = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind != argc - 1 || target < 2 || target > 0x7fffffff ||
+	realloc_ratio < 0 || realloc_ratio >= 1 ||
+	calloc_ratio < 0 || calloc_ratio > 1) {
+	usage();
+	exit(1);
+    }
+
+    /* Every allocation uses a new id, there are at most target of them */
+    rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    max_ids = (int)target;
+    max_ops = (int)target + 1;
+    if ((ops = malloc(max_ops * sizeof(traceop_t))) == NULL ||
+	(sizes = malloc(max_ids * sizeof(int))) == NULL ||
+	(slot = malloc(max_ids * sizeof(int))) == NULL ||
+	(live_ids = malloc(max_ids * sizeof(int))) == NULL ||
+	(heap = malloc(max_ids * sizeof(live_t))) == NULL)
+	unix_error("malloc failed in main");
+
+    /*
+     * Each step frees the blocks whose time has come, then allocates a
+     * block or reallocs a live one. The rest of the budget frees the
+     * blocks that are still live, so every block is freed in the end.
+     */
+    while (num_ops + num_live < target) {
+	while (heap_len > 0 && heap[0].death <= now)
+	    free_block(heap_pop());
+	if (num_ops + num_live >= target)
+	    break;
+
+	x = draw(&size_dist);
+	size = !(x >= 1) ? 1 : (x > MAX_SIZE) ? MAX_SIZE : (int)x;
+	if (num_live > 0 && rnd() < realloc_ratio) {
+	    id = live_ids[(int)(rnd() * num_live)];
+	    if (peak > 0 && live_bytes + size - sizes[id] > peak)
+		continue;   /* the next step may allocate instead */
+	    live_bytes += size - sizes[id];
+	    sizes[id] = size;
+	    emit(REALLOC, id, size);
+	    continue;
+	}
+
+	/* Make room under the peak by freeing the blocks that die first */
+	while (peak > 0 && heap_len > 0 && live_bytes + size > peak)
+	    free_block(heap_pop());
+	if (num_ops + num_live + 2 > target)
+	    break;
+	id = num_ids++;
+	sizes[id] = size;
+	slot[id] = num_live;
+	live_ids[num_live++] = id;
+	live_bytes += size;
+	x = draw(&life_dist);   /* no block lives past the end of the trace */
+	heap_push(now + 1 + (!(x >= 0) ? 0 : (x > target) ? target : (long)x), id);
+	/* Without callocs no number is drawn, so old seeds give old traces */
+	emit((calloc_ratio > 0 && rnd() < calloc_ratio) ? CALLOC : ALLOC, 
+	     id, size);
+	now++;
+    }
+    while (heap_len > 0)
+	free_block(heap_pop());
+
+    if ((out = fopen(argv[optind], binary ? "wb" : "w")) == NULL) {
+	sprintf(msg, "Could not open %s", argv[optind]);
+	unix_error(msg);
+    }
+    if (binary)
+	write_bin(out, num_ids, weight);
+    else
+	write_rep(out, num_ids, weight);
+    if (fclose(out) != 0) {
+	sprintf(msg, "Could not write %s", argv[optind]);
+	unix_error(msg);
+    }
+    exit(0);
+}
+
+/*
+ * parse_dist - Read a distribution: fixed:<n>, uniform:<min>:<max>,
+ *     lognormal:<median>:<sigma>, bimodal:<small>:<large>:<p>,
+ *     power:<min>:<max>:<alpha> or exp:<mean>
+ */
+static void parse_dist(char *arg, dist_t *d)
+{
+    char name[MAXLINE];
+    int n;
+
+    d->a = d->b = d->c = 0;
+    n = sscanf(arg, "%[a-z]:%lf:%lf:%lf", name, &d->a, &d->b, &d->c);
+    if (!strcmp(name, "fixed") && n == 2)
+	d->type = FIXED;
+    else if (!strcmp(name, "uniform") && n == 3 && d->a <= d->b)
+	d->type = UNIFORM;
+    else if (!strcmp(name, "lognormal") && n == 3 && d->a > 0)
+	d->type = LOGNORMAL;
+    else if (!strcmp(name, "bimodal") && n == 4 && d->c >= 0 && d->c <= 1)
+	d->type = BIMODAL;
+    else if (!strcmp(name, "power") && n == 4 && d->a > 0 && d->a < d->b &&
+	     d->c != 1)
+	d->type = POWER;
+    else if (!strcmp(name, "exp") && n == 2 && d->a > 0)
+	d->type = EXPONENTIAL;
+    else {
+	fprintf(stderr, "Bad distribution: %s\n", arg);
+	usage();
+	exit(1);
+    }
+}
+
+/*
+ * parse_size - Read a number with an optional K, M or G suffix
+ */
+static long parse_size(char *arg)
+{
+    long n;
+    char *end;
+
+    n = strtol(arg, &end, 0);
+    switch (*end) {
+    case 'K': case 'k': n <<= 10; end++; break;
+    case 'M': case 'm': n <<= 20; end++; break;
+    case 'G': case 'g': n <<= 30; end++; break;
+    }
+    if (*end != '\0' || end == arg || n < 0) {
+	fprintf(stderr, "Bad number: %s\n", arg);
+	usage();
+	exit(1);
+    }
+    return n;
+}
+
+/*
+ * draw - Draw a value from distribution d
+ */
+static double draw(dist_t *d)
+{
+    double u, v, lo, hi;
+
+    switch (d->type) {
+    case FIXED:
+	return d->a;
+    case UNIFORM:
+	return d->a + rnd() * (d->b - d->a + 1);
+    case LOGNORMAL:         /* Box-Muller gives the normal deviate */
+	u = 1.0 - rnd();
+	v = rnd();
+	return d->a * exp(d->b * sqrt(-2 * log(u)) * cos(2 * M_PI * v));
+    case BIMODAL:           /* each mode spreads by 25% around its size */
+	u = (rnd() < d->c) ? d->b : d->a;
+	return u * (0.75 + 0.5 * rnd());
+    case POWER:             /* inverse of the bounded Pareto distribution */
+	lo = pow(d->a, 1 - d->c);
+	hi = pow(d->b, 1 - d->c);
+	return pow(lo + rnd() * (hi - lo), 1 / (1 - d->c));
+    case EXPONENTIAL:
+	return -d->a * log(1.0 - rnd());
+    }
+    return 0;
+}
+
+/*
+ * rnd - Return a uniform random number in [0, 1), xorshift64* keeps
+ *     the traces the same on every libc
+ */
+static double rnd(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (double)((rng_state * 0x2545F4914F6CDD1DULL) >> 11) /
+	(double)(1ULL << 53);
+}
+
+/*
+ * emit - Append a request to the trace
+ */
+static void emit(int type, int id, int size)
+{
+    ops[num_ops].type = type;
+    ops[num_ops].index = id;
+    ops[num_ops].size = size;
+    ops[num_ops].align = 0;
+    num_ops++;
+}
+
+/*
+ * heap_push - Add live block id, which dies after death allocations
+ */
+static void heap_push(long death, int id)
+{
+    int i = heap_len++, parent;
+
+    while (i > 0 && heap[parent = (i - 1) / 2].death > death) {
+	heap[i] = heap[parent];
+	i = parent;
+    }
+    heap[i].death = death;
+    heap[i].id = id;
+}
+
+/*
+ * heap_pop - Remove the block that dies first and return its id
+ */
+static int heap_pop(void)
+{
+    live_t last = heap[--heap_len];
+    int id = heap[0].id;
+    int i = 0, child;
+
+    while ((child = 2 * i + 1) < heap_len) {
+	if (child + 1 < heap_len && heap[child + 1].death < heap[child].death)
+	    child++;
+	if (heap[child].death >= last.death)
+	    break;
+	heap[i] = heap[child];
+	i = child;
+    }
+    heap[i] = last;
+    return id;
+}
+
+/*
+ * free_block - Free live block id, it already left the heap
+ */
+static void free_block(int id)
+{
+    int moved = live_ids[--num_live];
+
+    live_ids[slot[id]] = moved;
+    slot[moved] = slot[id];
+    slot[id] = -1;
+    live_bytes -= sizes[id];
+    emit(FREE, id, 0);
+}
+
+/*
+ * write_rep - Write the trace as a .rep file
+ */
+static void write_rep(FILE *out, int num_ids, int weight)
+{
+    int i;
+
+    fprintf(out, "0\n%d\n%d\n%d\n", num_ids, num_ops, weight);
+    for (i = 0; i < num_ops; i++) {
+	switch (ops[i].type) {
+	case ALLOC:
+	    fprintf(out, "a %d %d\n", ops[i].index, ops[i].size);
+	    break;
+	case CALLOC:
+	    fprintf(out, "c %d %d\n", ops[i].index, ops[i].size);
+	    break;
+	case MEMALIGN:
+	    fprintf(out, "m %d %d %d\n", ops[i].index, ops[i].align, ops[i].size);
+	    break;
+	case REALLOC:
+	    fprintf(out, "r %d %d\n", ops[i].index, ops[i].size);
+	    break;
+	case FREE:
+	    fprintf(out, "f %d\n", ops[i].index);
+	    break;
+	}
+    }
+}
+
+/*
+ * write_bin - Write the trace in the binary format of trace.h
+ */
+static void write_bin(FILE *out, int num_ids, int weight)
+{
+    tracehdr_t hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    hdr.op_size = sizeof(traceop_t);
+    hdr.num_ids = num_ids;
+    hdr.num_ops = num_ops;
+    hdr.weight = weight;
+    fwrite(&hdr, sizeof(hdr), 1, out);
+    fwrite(ops, sizeof(traceop_t), num_ops, out);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-hb] [-n <ops>] [-s <dist>] [-l <dist>] [-r <ratio>]\n");
+    fprintf(stderr, "                [-c <ratio>] [-P <bytes>] [-S <seed>] [-w <weight>] <outfile>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Write a binary trace instead of a .rep file.\n");
+    fprintf(stderr, "\t-c <ratio> Share of the allocations that are callocs (default 0).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-l <dist>  Lifetimes in allocations (default exp:1000).\n");
+    fprintf(stderr, "\t-n <ops>   Number of requests, e.g. 2M (default 100000).\n");
+    fprintf(stderr, "\t-P <bytes> Keep at most <bytes> of payload live (default no cap).\n");
+    fprintf(stderr, "\t-r <ratio> Share of the requests that are reallocs (default 0).\n");
+    fprintf(stderr, "\t-s <dist>  Block sizes in bytes (default lognormal:64:1).\n");
+    fprintf(stderr, "\t-S <seed>  Seed of the random numbers (default 1).\n");
+    fprintf(stderr, "\t-w <w>     Weight of the trace (default 1).\n");
+    fprintf(stderr, "Distributions\n");
+    fprintf(stderr, "\tfixed:<n>  uniform:<min>:<max>  lognormal:<median>:<sigma>\n");
+    fprintf(stderr, "\tbimodal:<small>:<large>:<p>  power:<min>:<max>:<alpha>  exp:<mean>\n");
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}